@@ -1,7 +1,15 @@
 #version 450
 
 layout(local_size_x = 1, local_size_y = 1) in;
-layout(rgba32f, binding = 0) uniform image2D img_output;
+// Iteration count per pixel, negative while a pixel is still pending (see test.frag.glsl)
+layout(r32f, binding = 0) uniform image2D img_output;
+
+// Extra jittered samples per pixel and how many of the layers are filled, see supersample
+layout(r32f, binding = 1) uniform image2DArray aa_samples;
+layout(r32ui, binding = 2) uniform uimage2D aa_count;
+
+// Exterior distance estimate in pixels, 0 for interior points
+layout(r32f, binding = 3) uniform image2D de_output;
 
 layout(std140, binding = 1) buffer ScreenData
 {
@@ -27,56 +35,92 @@ uniform uint iterations = 20;
 uniform int d_prec = 0;
 uniform uint set = 0;
 
-uniform int cmode = 0;
-uniform vec3 colorGrad;
+// Origin of the dispatched rect and spacing between its samples, for tiles and coarse passes
+uniform ivec2 offset = ivec2(0);
+uniform int stride = 1;
 
-vec3 HSVtoRGB(float H, float S, float V){
-    float s = S/100;
-    float v = V/100;
-    float C = s*v;
-    float X = C*(1-abs(mod(H/60.0, 2)-1));
-    float m = v-C;
-    float r,g,b;
+// Skip pixels that are already exact (>= 0), only fill in pending ones
+uniform int pending_only = 0;
 
-    if(H < 5)
-    {
-        return vec3(0, 0, 0);
-    }
+// Store a continuous iteration count instead of the integer one
+uniform int smooth_it = 1;
 
-    if(H >= 5 && H < 60){
-        r = C,g = X,b = 0;
-    }
-    else if(H >= 60 && H < 120){
-        r = X,g = C,b = 0;
-    }
-    else if(H >= 120 && H < 180){
-        r = 0,g = C,b = X;
-    }
-    else if(H >= 180 && H < 240){
-        r = 0,g = X,b = C;
-    }
-    else if(H >= 240 && H < 300){
-        r = X,g = 0,b = C;
-    }
-    else{
-        r = C,g = 0,b = X;
-    }
-    float R = (r+m);
-    float G = (g+m);
-    float B = (b+m);
-    
-    return vec3(R, G, B);
+// Track dz/dc next to z and write the distance estimate to de_output
+uniform int dist_est = 0;
+
+// Supersampling skips pixels at least this many pixels away from the set
+uniform float aa_de_skip = 4.0;
+
+// Subpixel offset of the whole frame, for the idle accumulation
+uniform vec2 jitter = vec2(0.0);
+
+// Non zero runs a supersampling round over an exact frame instead of computing it
+uniform int aa_round = 0;
+
+// Log2 iteration difference to a neighbour that gets a pixel supersampled, and the standard error
+// of its samples it has to reach to stop, keep AA_SAMPLES and AA_BATCH in sync with main.cpp
+uniform float aa_threshold = 0.1;
+uniform float aa_tolerance = 0.02;
+const uint AA_SAMPLES = 8;
+const uint AA_BATCH = 2;
+
+// |z|^2 bailout for the smooth count, large enough for it to be continuous across bands
+const float SMOOTH_BAILOUT = 65536.0;
+
+// Uniforms can't initialize globals, the kernels take this once into a local
+float bailout()
+{
+    return smooth_it != 0 || dist_est != 0 ? SMOOTH_BAILOUT : 4.0;
 }
 
-uint _mandelF(float x, float y, uint maxit) {
+// Set by the kernels, in the complex plane
+float de = 0.0;
+
+// |z| ln|z| / |dz/dc| halved, independent of the degree
+float distance(uint i, uint maxit, float r2, float dz2)
+{
+    if(i >= maxit || dz2 <= 0.0)
+        return 0.0;
+
+    return 0.25 * sqrt(r2 / dz2) * log(r2);
+}
+
+// Continuous count in [i, i + 1) for an orbit of the given degree that escaped with |z|^2 = r2,
+// points that never escape get exactly maxit
+float smoothCount(uint i, uint maxit, float r2, float degree)
+{
+    if(i >= maxit)
+        return float(maxit);
+
+    if(smooth_it == 0)
+        return float(i);
+
+    float nu = log2(log2(r2) / log2(SMOOTH_BAILOUT)) / log2(degree);
+
+    // Must stay below maxit even once float precision runs out
+    return min(float(i) + clamp(1.0 - nu, 0.0, 0.9999), float(maxit) - 0.5);
+}
+
+float _mandelF(float x, float y, uint maxit) {
     float zr = 0;
     float zi = 0;
     float zrsqr = 0;
     float zisqr = 0;
+    float dzr = 0;
+    float dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
     for(i = 0; i < maxit; i++)
     {
+        // dz = 2 * z * dz + 1
+        if(dist_est != 0)
+        {
+            float t = 2 * (zr * dzr - zi * dzi) + 1;
+            dzi = 2 * (zr * dzi + zi * dzr);
+            dzr = t;
+        }
+
         zi = zr * zi;
         zi += zi;
         zi += y;
@@ -85,21 +129,32 @@ uint _mandelF(float x, float y, uint maxit) {
         zrsqr = zr * zr;
         zisqr = zi * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 2.0);
 }
 
-uint _mandelD(double x, double y, uint maxit) {
+float _mandelD(double x, double y, uint maxit) {
     double zr = 0;
     double zi = 0;
     double zrsqr = 0;
     double zisqr = 0;
+    double dzr = 0;
+    double dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
     for(i = 0; i < maxit; i++)
     {
+        if(dist_est != 0)
+        {
+            double t = 2 * (zr * dzr - zi * dzi) + 1;
+            dzi = 2 * (zr * dzi + zi * dzr);
+            dzr = t;
+        }
+
         zi = zr * zi;
         zi += zi;
         zi += y;
@@ -108,21 +163,34 @@ uint _mandelD(double x, double y, uint maxit) {
         zrsqr = zr * zr;
         zisqr = zi * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 2.0);
 }
 
-uint _shipF(float x, float y, uint maxit) {
+float _shipF(float x, float y, uint maxit) {
     float zr = 0;
     float zi = 0;
     float zrsqr = 0;
     float zisqr = 0;
+    float dzr = 0;
+    float dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
     for(i = 0; i < maxit; i++)
     {
+        // The abs folds are reflections, they keep |dz| so the fold is applied to dz as well
+        if(dist_est != 0)
+        {
+            float fr = sign(zr) * dzr;
+            float fi = sign(zi) * dzi;
+            float t = 2 * (abs(zr) * fr - abs(zi) * fi) + 1;
+            dzi = 2 * (abs(zr) * fi + abs(zi) * fr);
+            dzr = t;
+        }
 
         zi = zr * zi;
         zi += zi;
@@ -133,22 +201,34 @@ uint _shipF(float x, float y, uint maxit) {
         zrsqr = zr * zr;
         zisqr = zi * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 2.0);
 }
 
-uint _shipD(double x, double y, uint maxit) {
+float _shipD(double x, double y, uint maxit) {
     double zr = 0;
     double zi = 0;
     double zrsqr = 0;
     double zisqr = 0;
+    double dzr = 0;
+    double dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
 
     for(i = 0; i < maxit; i++)
     {
+        if(dist_est != 0)
+        {
+            double fr = sign(zr) * dzr;
+            double fi = sign(zi) * dzi;
+            double t = 2 * (abs(zr) * fr - abs(zi) * fi) + 1;
+            dzi = 2 * (abs(zr) * fi + abs(zi) * fr);
+            dzr = t;
+        }
         zi = zr * zi;
         zi += zi;
         zi = abs(zi);
@@ -158,23 +238,37 @@ uint _shipD(double x, double y, uint maxit) {
         zrsqr = zr * zr;
         zisqr = zi * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 2.0);
 }
 
-uint _mandel3F(float x, float y, uint maxit) {
+float _mandel3F(float x, float y, uint maxit) {
     float zr = 0;
     float zi = 0;
     float zrsqr = 0;
     float zisqr = 0;
     float zrcub = 0;
     float zicub = 0;
+    float dzr = 0;
+    float dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
     for(i = 0; i < maxit; i++)
     {
+        // dz = 3 * z^2 * dz + 1
+        if(dist_est != 0)
+        {
+            float sr = zrsqr - zisqr;
+            float si = 2 * zr * zi;
+            float t = 3 * (sr * dzr - si * dzi) + 1;
+            dzi = 3 * (sr * dzi + si * dzr);
+            dzr = t;
+        }
+
         zi = 3 * zrsqr * zi - zicub + y;
         zr = zrcub - 3 * zr * zisqr + x;
 
@@ -183,23 +277,36 @@ uint _mandel3F(float x, float y, uint maxit) {
         zrcub = zrsqr * zr;
         zicub = zisqr * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 3.0);
 }
 
-uint _mandel3D(double x, double y, uint maxit) {
+float _mandel3D(double x, double y, uint maxit) {
     double zr = 0;
     double zi = 0;
     double zrsqr = 0;
     double zisqr = 0;
     double zrcub = 0;
     double zicub = 0;
+    double dzr = 0;
+    double dzi = 0;
     uint i = 0;
+    float bail = bailout();
 
     for(i = 0; i < maxit; i++)
     {
+        if(dist_est != 0)
+        {
+            double sr = zrsqr - zisqr;
+            double si = 2 * zr * zi;
+            double t = 3 * (sr * dzr - si * dzi) + 1;
+            dzi = 3 * (sr * dzi + si * dzr);
+            dzr = t;
+        }
+
         zi = 3 * zrsqr * zi - zicub + y;
         zr = zrcub - 3 * zr * zisqr + x;
         
@@ -208,10 +315,11 @@ uint _mandel3D(double x, double y, uint maxit) {
         zrcub = zrsqr * zr;
         zicub = zisqr * zi;
 
-        if(zrsqr + zisqr > 4.0) break;
+        if(zrsqr + zisqr > bail) break;
     }
 
-    return i;
+    de = distance(i, maxit, float(zrsqr + zisqr), float(dzr * dzr + dzi * dzi));
+    return smoothCount(i, maxit, float(zrsqr + zisqr), 3.0);
 }
 
 // uint _anyExpressionF(float x, float y, uint maxit) {
@@ -234,14 +342,15 @@ uint _mandel3D(double x, double y, uint maxit) {
 //     return i;
 // }
 
-void main()
+// Iteration count at a pixel position, integer positions are the pixel samples themselves
+float sampleAt(vec2 pos)
 {
-    uint it = 0;
+    float it = 0.0;
 
     if(d_prec == 0)
     {
-        float lx = ((float(gl_GlobalInvocationID.x) / width - 0.5) * 2 * zoom * (16.0 / 9.0) - px);
-        float ly = ((float(gl_GlobalInvocationID.y) / height - 0.5) * 2 * zoom + py);
+        float lx = ((pos.x / width - 0.5) * 2 * zoom * (16.0 / 9.0) - px);
+        float ly = ((pos.y / height - 0.5) * 2 * zoom + py);
         if(set == 0)
             it = _mandelF(lx, ly, iterations);
         else if(set == 1)
@@ -251,25 +360,111 @@ void main()
     }
     else
     {
-        double lx = ((double(gl_GlobalInvocationID.x) / width - 0.5) * 2 * zoomd * (16.0 / 9.0) - pxd);
-        double ly = ((double(gl_GlobalInvocationID.y) / height - 0.5) * 2 * zoomd + pyd);
+        double lx = ((double(pos.x) / width - 0.5) * 2 * zoomd * (16.0 / 9.0) - pxd);
+        double ly = ((double(pos.y) / height - 0.5) * 2 * zoomd + pyd);
         if(set == 0)
             it = _mandelD(lx, ly, iterations);
         else if(set == 1)
             it = _shipD(lx, -ly, iterations);
-        else if(set == 3)
+        else if(set == 2)
             it = _mandel3D(lx, ly, iterations);
     }
 
-    float c = 1.0 - float(it) / float(iterations);
+    return it;
+}
 
-    if(cmode == 0)
+// Differences are measured on log2 of the count, interior points weigh as the limit
+float level(float it)
+{
+    return log2(1.0 + min(it, float(iterations)));
+}
+
+float contrast(ivec2 coord, float l)
+{
+    float c = 0.0;
+    ivec2 n[4] = { ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1) };
+
+    for(int i = 0; i < 4; i++)
     {
-        vec3 color = HSVtoRGB(c * 360, 100, 100);
-        imageStore(img_output, ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y), vec4(color, 1.0));
+        ivec2 p = clamp(coord + n[i], ivec2(0), ivec2(width, height) - 1);
+        c = max(c, abs(level(imageLoad(img_output, p).r) - l));
+    }
+
+    return c;
+}
+
+// Adds AA_BATCH samples to pixels that differ from their neighbours, and keeps adding to them each round
+// until the mean of their samples settles or the layers run out
+void supersample(ivec2 coord)
+{
+    uint n = imageLoad(aa_count, coord).r;
+
+    if(n >= AA_SAMPLES)
+        return;
+
+    float l = level(imageLoad(img_output, coord).r);
+
+    if(n == 0)
+    {
+        // Far enough from the boundary for the whole pixel to look the same
+        if(dist_est != 0 && imageLoad(de_output, coord).r > aa_de_skip)
+            return;
+
+        if(contrast(coord, l) < aa_threshold)
+            return;
     }
     else
     {
-        imageStore(img_output, ivec2(gl_GlobalInvocationID.x, gl_GlobalInvocationID.y), vec4(c * colorGrad, 1.0));
+        float sum = l, sum2 = l * l;
+        for(uint i = 0; i < n; i++)
+        {
+            float s = level(imageLoad(aa_samples, ivec3(coord, i)).r);
+            sum += s;
+            sum2 += s * s;
+        }
+
+        float k = float(n + 1);
+        float var = max(sum2 / k - (sum / k) * (sum / k), 0.0);
+
+        if(sqrt(var / k) < aa_tolerance)
+            return;
     }
+
+    // R2 low discrepancy offsets, rotated per pixel so neighbours don't share a pattern
+    uint h = uint(coord.x) * 1973u + uint(coord.y) * 9277u;
+    h = (h ^ (h >> 13)) * 0x5bd1e995u;
+    vec2 rot = vec2(h & 0xffffu, h >> 16) / 65536.0;
+
+    for(uint i = n; i < n + AA_BATCH; i++)
+    {
+        vec2 jitter = fract(rot + float(i + 1) * vec2(0.7548776662, 0.5698402910)) - 0.5;
+        imageStore(aa_samples, ivec3(coord, i), vec4(sampleAt(vec2(coord) + jitter)));
+    }
+
+    imageStore(aa_count, coord, uvec4(n + AA_BATCH));
+}
+
+void main()
+{
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy) * stride + offset;
+
+    if(coord.x >= width || coord.y >= height)
+        return;
+
+    if(aa_round != 0)
+    {
+        supersample(coord);
+        return;
+    }
+
+    if(pending_only != 0 && imageLoad(img_output, coord).r >= 0.0)
+        return;
+
+    float it = sampleAt(vec2(coord) + jitter);
+
+    imageStore(img_output, coord, vec4(it));
+
+    // In pixels, jittered frames keep the estimate of the pixel center
+    if(dist_est != 0 && jitter == vec2(0.0))
+        imageStore(de_output, coord, vec4(de * float(height) / (2.0 * zoom)));
 }
@@ -1,11 +1,136 @@
 #version 450
 
-uniform sampler2D texture; 
+// Iteration counts, pending pixels are stored as -(estimate + 1)
+uniform sampler2D frame;
 in vec2 tcoord;
 
+uniform uint iterations = 20;
+
+// 0 maps the counts relative to iterations, 1 repeats the palette every color_period iterations
+// so the colors stay put when iterations changes, 2 maps through the frame histogram, 3 by the
+// distance estimate
+uniform int color_scale = 0;
+uniform float color_period = 64.0;
+
+// Normalized cumulative histogram built by test_hist.cs.glsl and test_cdf.cs.glsl
+layout(std430, binding = 3) readonly buffer Cdf
+{
+    float cdf[];
+};
+
+const uint HIST_BINS = 4096;
+
+// Baked from the palette stops on the CPU, see bakePalette
+uniform sampler1D palette;
+const float PALETTE_SIZE = 1024.0;
+
+// Supersamples of the compute shader, averaged in color space
+uniform sampler2DArray aa_samples;
+uniform usampler2D aa_count;
+
+// 0 colors the frame, 1 colors a jittered frame for the accumulation (no supersamples),
+// 2 shows the accumulation, rgb sums with the sample count in alpha
+uniform int frag_mode = 0;
+uniform sampler2D accum;
+
+// Distance estimate in pixels, written when the compute shader runs with dist_est
+uniform sampler2D dist;
+
 out vec4 outColor;
 
+vec3 colorize(float it, float de)
+{
+    // Nothing to show yet (cleared buffer)
+    if(it > 1E29)
+        return vec3(0.0);
+
+    float c;
+
+    if(color_scale == 1)
+    {
+        // Never escaped
+        if(it >= float(iterations))
+            return vec3(0.0);
+
+        c = fract(it / color_period);
+    }
+    else if(color_scale == 2)
+    {
+        if(it >= float(iterations))
+            return vec3(0.0);
+
+        // Same binning as the histogram pass, interpolated inside the bin
+        float b = min(log2(1.0 + it) / log2(1.0 + float(iterations)) * float(HIST_BINS), float(HIST_BINS) - 0.001);
+        uint i = uint(b);
+        float lo = i > 0 ? cdf[i - 1] : 0.0;
+
+        c = 1.0 - mix(lo, cdf[i], fract(b));
+    }
+    else if(color_scale == 3)
+    {
+        if(it >= float(iterations))
+            return vec3(0.0);
+
+        // Thin boundary close to 0, up to a thousand pixels away spread over the palette
+        c = clamp(log2(1.0 + de) / 10.0, 0.0, 1.0);
+    }
+    else
+    {
+        c = clamp(1.0 - it / float(iterations), 0.0, 1.0);
+    }
+
+    // Land on the centers of the first and last texels at 0 and 1
+    return texture(palette, c * (PALETTE_SIZE - 1) / PALETTE_SIZE + 0.5 / PALETTE_SIZE).rgb;
+}
+
 void main()
 {
-    outColor = texture2D(texture, tcoord);
-}
\ No newline at end of file
+    ivec2 p = ivec2(tcoord * textureSize(frame, 0));
+
+    if(frag_mode == 2)
+    {
+        vec4 a = texelFetch(accum, p, 0);
+        outColor = vec4(a.rgb / max(a.a, 1.0), 1.0);
+        return;
+    }
+
+    ivec2 q = p;
+    float v = texelFetch(frame, p, 0).r;
+
+    // Not computed yet, show the nearest sample of the coarser passes instead
+    if(v < 0.0)
+    {
+        float v2 = texelFetch(frame, p & ~1, 0).r;
+        float v4 = texelFetch(frame, p & ~3, 0).r;
+
+        if(v2 >= 0.0)
+        {
+            v = v2;
+            q = p & ~1;
+        }
+        else if(v4 >= 0.0)
+        {
+            v = v4;
+            q = p & ~3;
+        }
+        else
+        {
+            v = -v - 1.0;
+        }
+    }
+
+    // Supersamples share the estimate of the pixel
+    float de = texelFetch(dist, q, 0).r;
+    vec3 color = colorize(v, de);
+    uint n = texelFetch(aa_count, p, 0).r;
+
+    if(n > 0 && frag_mode == 0)
+    {
+        for(uint i = 0; i < n; i++)
+            color += colorize(texelFetch(aa_samples, ivec3(p, i), 0).r, de);
+
+        color /= float(n + 1);
+    }
+
+    outColor = vec4(color, 1.0);
+}
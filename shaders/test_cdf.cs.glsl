@@ -0,0 +1,49 @@
+#version 450
+
+// One group scans the whole histogram, 4 bins per invocation
+layout(local_size_x = 1024) in;
+
+layout(std430, binding = 5) buffer Histogram
+{
+    uint hist[];
+};
+
+layout(std430, binding = 3) buffer Cdf
+{
+    float cdf[];
+};
+
+const uint HIST_BINS = 4096;
+
+shared uint sums[1024];
+
+void main()
+{
+    uint t = gl_LocalInvocationID.x;
+    uint b = t * 4;
+
+    uint c0 = hist[b];
+    uint c1 = c0 + hist[b + 1];
+    uint c2 = c1 + hist[b + 2];
+    uint c3 = c2 + hist[b + 3];
+
+    sums[t] = c3;
+    barrier();
+
+    // Inclusive scan of the per invocation totals
+    for(uint off = 1; off < 1024; off *= 2)
+    {
+        uint v = t >= off ? sums[t - off] : 0;
+        barrier();
+        sums[t] += v;
+        barrier();
+    }
+
+    uint before = sums[t] - c3;
+    float total = float(max(sums[1023], 1));
+
+    cdf[b] = float(before + c0) / total;
+    cdf[b + 1] = float(before + c1) / total;
+    cdf[b + 2] = float(before + c2) / total;
+    cdf[b + 3] = float(before + c3) / total;
+}
@@ -0,0 +1,109 @@
+#version 450
+
+// Each invocation takes a 4x4 block so a group covers 64x64 pixels, keeps the global flush count low
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(std140, binding = 1) buffer ScreenData
+{
+    uint width;
+    uint height;
+};
+
+layout(std430, binding = 5) buffer Histogram
+{
+    uint hist[];
+};
+
+// Read back to adapt the iteration limit, see adaptIterations
+layout(std430, binding = 4) buffer FrameStats
+{
+    uint interior;
+    uint escaped;
+    uint near_max;   // Escaped in the top quarter of the range
+    uint max_escape;
+};
+
+// Iteration counts, sampled on texture unit 3
+uniform sampler2D frame;
+uniform uint iterations = 20;
+
+// Bins are spaced on log2(1 + it) so 1M iteration frames still fit in a few thousand bins,
+// keep in sync with test.frag.glsl
+const uint HIST_BINS = 4096;
+
+shared uint local_hist[HIST_BINS];
+shared uint local_interior;
+shared uint local_escaped;
+shared uint local_near_max;
+shared uint local_max_escape;
+
+float binPos(float it)
+{
+    return log2(1.0 + it) / log2(1.0 + float(iterations)) * float(HIST_BINS);
+}
+
+void main()
+{
+    for(uint i = gl_LocalInvocationIndex; i < HIST_BINS; i += 256)
+        local_hist[i] = 0;
+
+    if(gl_LocalInvocationIndex == 0)
+    {
+        local_interior = 0;
+        local_escaped = 0;
+        local_near_max = 0;
+        local_max_escape = 0;
+    }
+
+    barrier();
+
+    ivec2 base = ivec2(gl_GlobalInvocationID.xy) * 4;
+
+    for(int y = 0; y < 4; y++)
+    {
+        for(int x = 0; x < 4; x++)
+        {
+            ivec2 p = base + ivec2(x, y);
+
+            if(p.x >= width || p.y >= height)
+                continue;
+
+            float v = texelFetch(frame, p, 0).r;
+
+            // Pending pixels count with their estimate
+            if(v < 0.0)
+                v = -v - 1.0;
+
+            // Interior and nothing computed yet are drawn black anyway
+            if(v >= float(iterations))
+            {
+                if(v < 1E29)
+                    atomicAdd(local_interior, 1);
+                continue;
+            }
+
+            atomicAdd(local_hist[min(uint(binPos(v)), HIST_BINS - 1)], 1);
+            atomicAdd(local_escaped, 1);
+            atomicMax(local_max_escape, uint(v));
+
+            if(v >= 0.75 * float(iterations))
+                atomicAdd(local_near_max, 1);
+        }
+    }
+
+    barrier();
+
+    for(uint i = gl_LocalInvocationIndex; i < HIST_BINS; i += 256)
+    {
+        if(local_hist[i] != 0)
+            atomicAdd(hist[i], local_hist[i]);
+    }
+
+    if(gl_LocalInvocationIndex == 0)
+    {
+        atomicAdd(interior, local_interior);
+        atomicAdd(escaped, local_escaped);
+        atomicAdd(near_max, local_near_max);
+        atomicMax(max_escape, local_max_escape);
+    }
+}
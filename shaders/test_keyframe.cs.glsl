@@ -0,0 +1,39 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(r32f, binding = 0) uniform image2D img_output;
+layout(r32f, binding = 3) uniform image2D de_output;
+
+layout(std140, binding = 1) buffer ScreenData
+{
+    uint width;
+    uint height;
+};
+
+// Keyframe at twice the resolution of the frame, iteration counts on texture unit 1 and distance estimates
+// on texture unit 3, both filtered linearly
+uniform sampler2D key_iter;
+uniform sampler2D key_de;
+
+// Magnification of the keyframe over the one of the frame, in (0.5, 1]
+uniform float scale;
+uniform int dist_est;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+
+    if(coord.x >= width || coord.y >= height)
+        return;
+
+    // Both zoom around the center, the keyframe has two texels per pixel of its view
+    vec2 size = vec2(width, height);
+    vec2 pos = 2.0 * (size * 0.5 + (vec2(coord) - size * 0.5) * scale);
+    vec2 uv = (pos + 0.5) / (2.0 * size);
+
+    imageStore(img_output, coord, vec4(texture(key_iter, uv).r));
+
+    // From keyframe texels to frame pixels
+    if(dist_est != 0)
+        imageStore(de_output, coord, vec4(texture(key_de, uv).r * 0.5 / scale));
+}
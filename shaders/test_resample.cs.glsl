@@ -0,0 +1,75 @@
+#version 450
+
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(r32f, binding = 0) uniform image2D img_output;
+
+layout(std140, binding = 1) buffer ScreenData
+{
+    uint width;
+    uint height;
+};
+
+// Last frame, sampled on texture unit 1
+uniform sampler2D last_frame;
+
+// Maps a pixel of the new view to its position on the last frame
+uniform vec2 scale;
+uniform vec2 shift;
+
+// Iteration limit the last frame was computed with and the one it is reused for
+uniform float old_iterations;
+uniform float new_iterations;
+
+// Pending pixels store -(estimate + 1), exact ones the iteration count itself
+float estimate(float v)
+{
+    return v >= 0.0 ? v : -v - 1.0;
+}
+
+float fetch(ivec2 p)
+{
+    return estimate(texelFetch(last_frame, clamp(p, ivec2(0), ivec2(width, height) - 1), 0).r);
+}
+
+void main()
+{
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+
+    if(coord.x >= width || coord.y >= height)
+        return;
+
+    vec2 src = vec2(coord) * scale + shift;
+    vec2 srci = round(src);
+    ivec2 isrc = ivec2(srci);
+
+    bool inside = isrc.x >= 0 && isrc.y >= 0 && isrc.x < width && isrc.y < height;
+
+    if(inside && all(lessThan(abs(src - srci), vec2(1e-3))))
+    {
+        // The sample grids line up, keep the old sample as is
+        float v = texelFetch(last_frame, isrc, 0).r;
+
+        // Escape counts under both limits stay valid. With a lower limit the rest is interior, with a higher
+        // one the old interior has to be iterated further. The last iteration is redone too, its smooth
+        // count is clamped under the limit
+        if(old_iterations != new_iterations && v >= 0.0 && v >= min(old_iterations, new_iterations) - 1.0)
+            v = new_iterations < old_iterations && v >= new_iterations ? new_iterations : -new_iterations - 1.0;
+
+        imageStore(img_output, coord, vec4(v));
+    }
+    else
+    {
+        // Bilinear preview of the iteration counts, stored as pending for the compute shader to fill in
+        vec2 f = src - floor(src);
+        ivec2 p = ivec2(floor(src));
+        float top = mix(fetch(p + ivec2(0, 1)), fetch(p + ivec2(1, 1)), f.x);
+        float bottom = mix(fetch(p), fetch(p + ivec2(1, 0)), f.x);
+        float v = mix(bottom, top, f.y);
+
+        // Outside the last frame there is nothing to preview
+        if(!inside)
+            v = 1E30;
+
+        imageStore(img_output, coord, vec4(-v - 1.0));
+    }
+}
@@ -14,6 +14,33 @@
 #include <cmath>
 #include <chrono>
 #include <filesystem>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <cstring>
+#include <queue>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <dlfcn.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
 
 #define CS_NO_ERROR 0x0
 #define CS_FILE_NOT_OPENED 0x1
@@ -30,6 +57,25 @@
 #define T_SIZE_W 1920
 #define T_SIZE_H 1080
 
+#define TILE_SIZE 128
+
+#define PALETTE_SIZE 1024
+
+#define HIST_BINS 4096
+
+// Supersample layers per pixel and how many a round adds, keep in sync with test.cs.glsl
+#define AA_SAMPLES 8
+#define AA_BATCH 2
+
+// Idle frames blended into the accumulation before it stops
+#define ACCUM_FRAMES 256
+
+// Captured frames in flight between the GPU and the file
+#define READBACK_SLOTS 3
+
+// Converted frames waiting for the I/O thread, also bounds its queue
+#define WRITER_BUFFERS 4
+
 // Profile with nsight -> I dont think memory access is very performant 
 
 enum class LinkType
@@ -100,10 +146,24 @@ struct InitData
 {
     GLuint compute_program;
     GLuint render_program;
+    GLuint resample_program;
+    GLuint hist_program;
+    GLuint cdf_program;
+    GLuint keyframe_program;
 
     GLint tex_w;
     GLint tex_h;
-    GLuint texture;
+    GLuint iter_texture;      // Iteration count per pixel, written by the compute shader
+    GLuint back_iter_texture; // Previous frame is shifted into this one, then they get swapped
+    GLuint color_texture;     // Colored frame for captures, rendered through fb
+    GLuint palette_texture;   // 1D color lookup, baked from the palette stops
+    GLuint aa_texture;        // AA_SAMPLES layers of jittered iteration counts
+    GLuint aa_count_texture;  // How many of those layers each pixel has filled
+    GLuint accum_texture;     // Summed colors of the idle jittered frames, sample count in alpha
+    GLuint accum_fb;
+    GLuint de_texture;        // Distance estimate in pixels, image unit 3 and texture unit 7
+    GLuint key_texture;       // Keyframe of a zoom capture at twice the resolution, iteration counts
+    GLuint key_de_texture;    // and distance estimates
     GLuint fb;
     GLuint rb;
 
@@ -111,6 +171,9 @@ struct InitData
     GLuint rect_vbo;
 
     GLuint cs_ssbo[2];
+    GLuint hist_ssbo;         // Iteration histogram, HIST_BINS counters
+    GLuint cdf_ssbo;          // Its normalized cumulative sum, read when coloring
+    GLuint stats_ssbo;        // FrameStats of the histogram pass
 
     GLint pxl;
     GLint pyl;
@@ -125,8 +188,28 @@ struct InitData
 
     GLint setl;
 
-    GLint cmodel;
-    GLint color_gradl;
+    GLint render_max_itl;
+    GLint color_periodl;
+    GLint color_scalel;
+    GLint hist_max_itl;
+
+    GLint offsetl;
+    GLint stridel;
+    GLint pending_onlyl;
+    GLint smooth_itl;
+    GLint aa_roundl;
+    GLint aa_thresholdl;
+    GLint jitterl;
+    GLint dist_estl;
+    GLint frag_model;
+
+    GLint resample_scalel;
+    GLint resample_shiftl;
+    GLint resample_old_itl;
+    GLint resample_new_itl;
+
+    GLint keyframe_scalel;
+    GLint keyframe_dist_estl;
 };
 
 struct BinomialData
@@ -142,6 +225,18 @@ static InitData Initialize(GLuint w, GLuint h)
     LoadShaderFromFile(GL_COMPUTE_SHADER, "shaders/test.cs.glsl", &p);
     r.compute_program = p;
 
+    LoadShaderFromFile(GL_COMPUTE_SHADER, "shaders/test_resample.cs.glsl", &p);
+    r.resample_program = p;
+
+    LoadShaderFromFile(GL_COMPUTE_SHADER, "shaders/test_hist.cs.glsl", &p);
+    r.hist_program = p;
+
+    LoadShaderFromFile(GL_COMPUTE_SHADER, "shaders/test_cdf.cs.glsl", &p);
+    r.cdf_program = p;
+
+    LoadShaderFromFile(GL_COMPUTE_SHADER, "shaders/test_keyframe.cs.glsl", &p);
+    r.keyframe_program = p;
+
     LoadShaderFromFile(GL_VERTEX_SHADER, "shaders/test.vert.glsl", &p);
     LoadShaderFromFile(GL_FRAGMENT_SHADER, "shaders/test.frag.glsl", &p, LinkType::EXISTING);
     r.render_program = p;
@@ -149,22 +244,32 @@ static InitData Initialize(GLuint w, GLuint h)
     r.tex_w = w;
     r.tex_h = h;
 
-    glGenTextures(1, &r.texture);
+    GLuint* iter_textures[] = { &r.iter_texture, &r.back_iter_texture };
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, r.texture);
+    for(GLuint* t : iter_textures)
+    {
+        glGenTextures(1, t);
+        glBindTexture(GL_TEXTURE_2D, *t);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+    }
+
+    glBindImageTexture(0, r.iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+
+    glGenTextures(1, &r.color_texture);
+    glBindTexture(GL_TEXTURE_2D, r.color_texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Change back to nearest
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // Change back to nearest
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-    glBindImageTexture(0, r.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-
-    // glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    // glBindImageTexture(0, r.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32UI);
 
     glGenFramebuffers(1, &r.fb);
     glBindFramebuffer(GL_FRAMEBUFFER, r.fb); // Keep always bound!
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r.texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r.color_texture, 0);
     
     glGenRenderbuffers(1, &r.rb);
     glBindRenderbuffer(GL_RENDERBUFFER, r.rb); 
@@ -199,6 +304,19 @@ static InitData Initialize(GLuint w, GLuint h)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, r.cs_ssbo[0]);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), ScreenData, GL_STATIC_READ);
 
+    // Binding 2 belongs to the polynomial data
+    glGenBuffers(1, &r.hist_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, r.hist_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, HIST_BINS * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &r.cdf_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, r.cdf_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, HIST_BINS * sizeof(GLfloat), NULL, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &r.stats_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, r.stats_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+
     glUseProgram(r.compute_program);
     r.pxl = glGetUniformLocation(r.compute_program, "px");
     r.pyl = glGetUniformLocation(r.compute_program, "py");
@@ -214,173 +332,3678 @@ static InitData Initialize(GLuint w, GLuint h)
 
     r.setl = glGetUniformLocation(r.compute_program, "set");
 
-    r.cmodel = glGetUniformLocation(r.compute_program, "cmode");
-    r.color_gradl = glGetUniformLocation(r.compute_program, "colorGrad");
+    r.offsetl = glGetUniformLocation(r.compute_program, "offset");
+
+    r.stridel = glGetUniformLocation(r.compute_program, "stride");
+    r.pending_onlyl = glGetUniformLocation(r.compute_program, "pending_only");
+    r.smooth_itl = glGetUniformLocation(r.compute_program, "smooth_it");
+    r.aa_roundl = glGetUniformLocation(r.compute_program, "aa_round");
+    r.aa_thresholdl = glGetUniformLocation(r.compute_program, "aa_threshold");
+    r.jitterl = glGetUniformLocation(r.compute_program, "jitter");
+    r.dist_estl = glGetUniformLocation(r.compute_program, "dist_est");
+
+    glUseProgram(r.resample_program);
+    r.resample_scalel = glGetUniformLocation(r.resample_program, "scale");
+    r.resample_shiftl = glGetUniformLocation(r.resample_program, "shift");
+    r.resample_old_itl = glGetUniformLocation(r.resample_program, "old_iterations");
+    r.resample_new_itl = glGetUniformLocation(r.resample_program, "new_iterations");
+    glUniform1i(glGetUniformLocation(r.resample_program, "last_frame"), 1);
+
+    glUseProgram(r.keyframe_program);
+    r.keyframe_scalel = glGetUniformLocation(r.keyframe_program, "scale");
+    r.keyframe_dist_estl = glGetUniformLocation(r.keyframe_program, "dist_est");
+    glUniform1i(glGetUniformLocation(r.keyframe_program, "key_iter"), 1);
+    glUniform1i(glGetUniformLocation(r.keyframe_program, "key_de"), 3);
+
+    glUseProgram(r.hist_program);
+    r.hist_max_itl = glGetUniformLocation(r.hist_program, "iterations");
+    glUniform1i(glGetUniformLocation(r.hist_program, "frame"), 3);
+
+    glUseProgram(r.render_program);
+    r.render_max_itl = glGetUniformLocation(r.render_program, "iterations");
+    r.color_periodl = glGetUniformLocation(r.render_program, "color_period");
+    r.color_scalel = glGetUniformLocation(r.render_program, "color_scale");
+    glUniform1i(glGetUniformLocation(r.render_program, "palette"), 2);
+    glUniform1i(glGetUniformLocation(r.render_program, "aa_samples"), 4);
+    glUniform1i(glGetUniformLocation(r.render_program, "aa_count"), 5);
+    glUniform1i(glGetUniformLocation(r.render_program, "accum"), 6);
+    glUniform1i(glGetUniformLocation(r.render_program, "dist"), 7);
+    r.frag_model = glGetUniformLocation(r.render_program, "frag_mode");
+
+    // Lives on texture unit 2 for good
+    glGenTextures(1, &r.palette_texture);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_1D, r.palette_texture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, PALETTE_SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    // Supersamples, image units 1 and 2 for the compute shader, texture units 4 and 5 for coloring
+    glGenTextures(1, &r.aa_texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, r.aa_texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, w, h, AA_SAMPLES);
+    glBindImageTexture(1, r.aa_texture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32F);
+
+    glGenTextures(1, &r.aa_count_texture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, r.aa_count_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, w, h);
+    glBindImageTexture(2, r.aa_count_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+
+    static const GLuint zero = 0;
+    glClearTexImage(r.aa_count_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    // Idle accumulation, blended into through its own framebuffer and shown from texture unit 6
+    glGenTextures(1, &r.accum_texture);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, r.accum_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    glGenFramebuffers(1, &r.accum_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, r.accum_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r.accum_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, r.fb);
+
+    glGenTextures(1, &r.de_texture);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, r.de_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, w, h);
+    glBindImageTexture(3, r.de_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+
+    // Only bound while resampling a capture frame
+    GLuint* key_textures[] = { &r.key_texture, &r.key_de_texture };
+    glActiveTexture(GL_TEXTURE1);
+    for(GLuint* t : key_textures)
+    {
+        glGenTextures(1, t);
+        glBindTexture(GL_TEXTURE_2D, *t);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, 2 * w, 2 * h);
+    }
+    glActiveTexture(GL_TEXTURE0);
 
     return r;
 }
 
+// I like being a bad boy (...)
+unsigned set = 0;
+double g_scroll = 1;
+unsigned iterations = 20;
+// Limit the iteration buffer was computed with. Coloring goes by it, adaptive iterations may change the
+// setting between a dispatch and the frame being colored or saved
+unsigned buffer_iterations = 20;
+bool d_prec = false;
+bool single_mode = false;
+bool dispatch_todo = false;
+bool pow2_zoom = false;
+bool smooth_it = true;
+bool dist_est = false;
+double lx = 0.0, ly = 0.0;
+
 int epoch_min = 0;
 
-void saveFBOImage(InitData& idata)
+struct PaletteStop
 {
-    auto dirname = std::filesystem::current_path() / std::to_string(epoch_min).c_str();
+    float pos;
+    float color[3];
+};
+
+// Globals the coloring reads, the iteration buffer does not depend on them
+float single_color[3];
+int color_mode = 0;
+int color_scale = 0;
+
+// The idle accumulation holds colored samples, any color change has to restart it
+bool accum_dirty = false;
+float color_period = 64.0f;
+std::vector<PaletteStop> custom_stops = { { 0.0f, { 0.0f, 0.0f, 0.0f } }, { 1.0f, { 1.0f, 1.0f, 1.0f } } };
+bool palette_dirty = true;
+
+// Stops of the selected color mode
+static std::vector<PaletteStop> paletteStops()
+{
+    if(color_mode == 0)
+    {
+        // Same ramp the old HSV mode had, black below 5 degrees then around the hue circle
+        return {
+            { 0.0f,           { 0.0f, 0.0f,       0.0f } },
+            { 4.99f / 360.0f, { 0.0f, 0.0f,       0.0f } },
+            { 5.0f / 360.0f,  { 1.0f, 5.0f / 60,  0.0f } },
+            { 1.0f / 6.0f,    { 1.0f, 1.0f,       0.0f } },
+            { 2.0f / 6.0f,    { 0.0f, 1.0f,       0.0f } },
+            { 3.0f / 6.0f,    { 0.0f, 1.0f,       1.0f } },
+            { 4.0f / 6.0f,    { 0.0f, 0.0f,       1.0f } },
+            { 5.0f / 6.0f,    { 1.0f, 0.0f,       1.0f } },
+            { 1.0f,           { 1.0f, 0.0f,       0.0f } }
+        };
+    }
+    else if(color_mode == 1)
+    {
+        return { { 0.0f, { 0.0f, 0.0f, 0.0f } }, { 1.0f, { single_color[0], single_color[1], single_color[2] } } };
+    }
+    return custom_stops;
+}
+
+// Linear interpolation between the stops, PALETTE_SIZE RGBA entries
+static void bakePalette(std::vector<PaletteStop> stops, float* out)
+{
+    std::stable_sort(stops.begin(), stops.end(), [](const PaletteStop& a, const PaletteStop& b) { return a.pos < b.pos; });
 
-    std::filesystem::create_directory(dirname);
-    static int frame = 0;
-    FILE* out = fopen((dirname.string() + "/frame" + std::to_string(frame++) + ".ppm").c_str(), "wb");
+    size_t s = 0;
+    for(int i = 0; i < PALETTE_SIZE; i++)
+    {
+        float t = i / (float)(PALETTE_SIZE - 1);
+
+        while(s + 1 < stops.size() && stops[s + 1].pos <= t)
+            s++;
+
+        const PaletteStop& a = stops[s];
+        const PaletteStop& b = stops[std::min(s + 1, stops.size() - 1)];
+        float f = (b.pos > a.pos) ? std::clamp((t - a.pos) / (b.pos - a.pos), 0.0f, 1.0f) : 0.0f;
+
+        // Before the first stop
+        if(t < a.pos)
+            f = 0.0f;
 
-    float* data = nullptr;
-    data = (float*)malloc(T_SIZE_W * T_SIZE_H * 4 * sizeof(float));
-    //glNamedFramebufferReadBuffer(idata.fb, GL_COLOR_ATTACHMENT0);
-    //glReadPixels(0, 0, T_SIZE_W, T_SIZE_H, GL_RGBA, GL_FLOAT, data);
+        for(int c = 0; c < 3; c++)
+            out[4 * i + c] = a.color[c] + (b.color[c] - a.color[c]) * f;
+        out[4 * i + 3] = 1.0f;
+    }
+}
+
+// Equalization needs the counts of the whole frame, local histograms per group are merged into hist_ssbo
+// then scanned into cdf_ssbo
+static void buildHistogram(InitData& idata)
+{
+    static const GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, idata.hist_ssbo);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, idata.stats_ssbo);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, idata.iter_texture);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, idata.texture);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data);
-    
-    //glNamedFramebufferReadBuffer(0, GL_COLOR_ATTACHMENT0);
 
-    // Header
-    fprintf(out, "P6\n%d %d\n255\n", T_SIZE_W, T_SIZE_H);
+    glUseProgram(idata.hist_program);
+    glUniform1ui(idata.hist_max_itl, buffer_iterations);
+    glDispatchCompute((T_SIZE_W + 63) / 64, (T_SIZE_H + 63) / 64, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-    int k = 0;
+    glUseProgram(idata.cdf_program);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
 
-    for(int i = 0; i < T_SIZE_W; i++)
+static void setColorUniforms(InitData& idata)
+{
+    if(palette_dirty)
     {
-        for(int j = 0; j < T_SIZE_H; j++)
+        std::vector<PaletteStop> stops = paletteStops();
+        static float lut[PALETTE_SIZE * 4];
+
+        if(!stops.empty())
         {
-            unsigned char local[3] = { (unsigned)(data[k] * 255), (unsigned)(data[k+1] * 255), (unsigned)(data[k+2] * 255) };
-            //fprintf(out, "%u %u %u\n", (unsigned)(data[k] * 255), (unsigned)(data[k+1] * 255), (unsigned)(data[k+2] * 255));
-            fwrite(local, 1, 3, out);
-            //printf("Doing ==> %u %u %u\n", (unsigned)(data[k] * 255), (unsigned)(data[k+1] * 255), (unsigned)(data[k+2] * 255));
-            k += 4;
+            bakePalette(stops, lut);
+            glActiveTexture(GL_TEXTURE2);
+            glTexSubImage1D(GL_TEXTURE_1D, 0, 0, PALETTE_SIZE, GL_RGBA, GL_FLOAT, lut);
+            glActiveTexture(GL_TEXTURE0);
         }
+        palette_dirty = false;
+        accum_dirty = true;
     }
 
-    free(data);
+    if(color_scale == 2)
+        buildHistogram(idata);
 
-    fclose(out);
+    glUseProgram(idata.render_program);
+    glUniform1ui(idata.render_max_itl, buffer_iterations);
+    glUniform1i(idata.color_scalel, color_scale);
+    glUniform1f(idata.color_periodl, color_period);
 }
 
-static void CleanUp(InitData& d)
+// Color an iteration buffer into fb, mode as frag_mode in test.frag.glsl
+static void drawColor(InitData& idata, GLuint fb, GLuint iter_texture, int mode)
 {
-    glDeleteProgram(d.compute_program);
-    glDeleteProgram(d.render_program);
+    setColorUniforms(idata);
+    glUniform1i(idata.frag_model, mode);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    glViewport(0, 0, T_SIZE_W, T_SIZE_H);
+    glBindVertexArray(idata.rect_vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, iter_texture);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    glDeleteTextures(1, &d.texture);
+// Color the iteration buffer into color_texture
+static void resolveColor(InitData& idata)
+{
+    drawColor(idata, idata.fb, idata.iter_texture, 0);
+}
 
-    glDeleteBuffers(1, d.cs_ssbo);
-    glDeleteBuffers(1, &d.rect_vbo);
+// Converted frames go through a pool of buffers to a dedicated I/O thread, which writes each one in a
+// single call. Acquiring a buffer blocks once the pool is used up, so the queue stays bounded
+struct FrameBuffer
+{
+    std::vector<unsigned char> data;
+    size_t size = 0;
+    std::string path;
+    int frame = -1;   // Capture frame number, journaled once written
+    unsigned iterations = 0; // Limit the frame was iterated with, journaled along
+    FILE* stream = nullptr; // Capture stream it is appended to instead of going to path
+};
 
-    glDeleteVertexArrays(1, &d.rect_vao);
+struct FrameWriter
+{
+    FrameBuffer buffers[WRITER_BUFFERS];
+    std::vector<FrameBuffer*> free;
+    std::deque<FrameBuffer*> queue;
+
+    std::thread io;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool quit = false;
+
+    // Set while a capture streams Y4M, frames are appended to it instead of going to their own files.
+    // Only the UI thread touches it, the frames carry it along
+    FILE* stream = nullptr;
+
+    // Capture journal, every frame that made it to disk gets a line
+    FILE* journal = nullptr;
+};
+
+FrameWriter writer;
+
+// Flushed all the way to the disk, before anything that vouches for the data (a rename, a journal line)
+static bool syncFile(FILE* f)
+{
+    if(fflush(f) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
 }
 
-// I like being a bad boy (...)
-unsigned set = 0;
-double g_scroll = 1;
-unsigned iterations = 20;
-bool d_prec = false;
-bool single_mode = false;
-bool dispatch_todo = false;
-double lx = 0.0, ly = 0.0;
+static void writerThread()
+{
+    std::unique_lock<std::mutex> l(writer.lock);
 
-float single_color[3];
-int color_mode = 0;
+    while(true)
+    {
+        writer.cv.wait(l, [] { return writer.quit || !writer.queue.empty(); });
 
-bool dispatchDone = false;
-double curr_mag = 1.0;
-double min_mag = 1.0f;
-double max_mag = 1.0f;
-float mult_frame = 2.0f;
-unsigned number_frames = 0;
-unsigned c_frame = 0;
-std::chrono::steady_clock::time_point tp;
-std::chrono::steady_clock::time_point ltp;
-double iterations_real = 0.0;
+        if(writer.queue.empty())
+            return;
 
-long long runSingleFrameTimed(double mag, InitData& idata)
+        FrameBuffer* buf = writer.queue.front();
+        writer.queue.pop_front();
+
+        // Opening and closing swap it under the lock, closing only after the queue drained
+        FILE* journal = writer.journal;
+
+        l.unlock();
+
+        // Files go under a temporary name first, so a frame file that exists is a complete one
+        std::string part = buf->path + ".part";
+        FILE* out = buf->stream ? buf->stream : fopen(part.c_str(), "wb");
+        bool written = false;
+        if(buf->stream)
+        {
+            written = fwrite(buf->data.data(), 1, buf->size, out) == buf->size && fflush(out) == 0;
+        }
+        else if(out)
+        {
+            written = fwrite(buf->data.data(), 1, buf->size, out) == buf->size;
+            written &= syncFile(out);
+            written &= fclose(out) == 0;
+
+            std::error_code ec;
+            std::filesystem::rename(part, buf->path, ec);
+            written &= !ec;
+        }
+        else
+        {
+            std::cerr << "Could not open file: " << buf->path << std::endl;
+        }
+
+        // A crash can't leave a journaled frame behind that isn't on disk, stream frames get synced here
+        if(written && buf->frame >= 0 && journal && (!buf->stream || syncFile(buf->stream)))
+        {
+            fprintf(journal, "frame %d %u\n", buf->frame, buf->iterations);
+            fflush(journal);
+        }
+        l.lock();
+
+        writer.free.push_back(buf);
+        writer.cv.notify_all();
+    }
+}
+
+static void initWriter()
 {
-    // Time
-    tp = std::chrono::high_resolution_clock::now();
-    auto dur = tp - ltp;
-    ltp = tp;
+    for(FrameBuffer& buf : writer.buffers)
+        writer.free.push_back(&buf);
 
-    // Setup
-    g_scroll = 1.0 / mag;
-    iterations_real *= mult_frame;
-    //iterations = (unsigned)iterations_real;
+    writer.io = std::thread(writerThread);
+}
 
-    // Dispatch
-    dispatch_todo = true;
+static FrameBuffer* acquireFrameBuffer()
+{
+    std::unique_lock<std::mutex> l(writer.lock);
+    writer.cv.wait(l, [] { return !writer.free.empty(); });
+
+    FrameBuffer* buf = writer.free.back();
+    writer.free.pop_back();
+    buf->stream = nullptr;
+    return buf;
+}
+
+static void submitFrameBuffer(FrameBuffer* buf, int frame, unsigned iterations)
+{
+    buf->frame = frame;
+    buf->iterations = iterations;
+
+    std::lock_guard<std::mutex> l(writer.lock);
+    writer.queue.push_back(buf);
+    writer.cv.notify_all();
+}
+
+static void finishWriter()
+{
+    if(!writer.io.joinable())
+        return;
+
+    std::unique_lock<std::mutex> l(writer.lock);
+    writer.cv.wait(l, [] { return writer.free.size() == WRITER_BUFFERS; });
+}
+
+static void shutdownWriter()
+{
+    if(!writer.io.joinable())
+        return;
+
+    finishWriter();
 
-    // Save last frame
-    if(dispatchDone)
     {
-        saveFBOImage(idata);
+        std::lock_guard<std::mutex> l(writer.lock);
+        writer.quit = true;
+        writer.cv.notify_all();
     }
-    return dur.count();
+    writer.io.join();
 }
 
-void scroll_callback(GLFWwindow* w, double sx, double sy)
+// RGBA32F rows, bottom up as GL stores them, into top down RGB8 rows with clamping and rounding.
+// Each pixel stores 4 bytes 3 apart, the next one overwrites the alpha, so dst needs a byte of slack
+static void convertRGB8(const float* src, unsigned char* dst, int w, int h)
 {
-    g_scroll *= exp(-(sy * 0.1f));
+    for(int y = 0; y < h; y++)
+    {
+        const float* row = src + (size_t)(h - 1 - y) * w * 4;
+        unsigned char* out = dst + (size_t)y * w * 3;
+        int x = 0;
+
+#ifdef HAVE_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+
+        for(; x + 4 <= w; x += 4)
+        {
+            __m128i p[4];
+            for(int k = 0; k < 4; k++)
+            {
+                __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(row + 4 * (x + k)), zero), one);
+                p[k] = _mm_cvtps_epi32(_mm_mul_ps(v, scale)); // Rounds to nearest
+            }
+
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(p[0], p[1]), _mm_packs_epi32(p[2], p[3]));
+
+            for(int k = 0; k < 4; k++)
+            {
+                int px = _mm_cvtsi128_si32(bytes);
+                memcpy(out + 3 * (x + k), &px, 4);
+                bytes = _mm_srli_si128(bytes, 4);
+            }
+        }
+#endif
+
+        for(; x < w; x++)
+        {
+            for(size_t c = 0; c < 3; c++)
+                out[3 * (size_t)x + c] = (unsigned char)(std::clamp(row[4 * (size_t)x + c], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
 }
 
-void ui_window(InitData& idata)
+// Render larger than the buffers, done as a grid of T_SIZE_W x T_SIZE_H tiles. It is a P6 PPM written in
+// place, every tile that lands has its rows put at their offsets, so no more than a few tiles are held
+// at once whatever the size. Tiles are numbered row by row from the bottom left, like the texture rows
+struct Poster
 {
-    static const char* sets_name[] = {"Mandelbrot", "Burning Ship", "Mandelbrot-3"};
-    static const char* color_modes[] = {"Full Hue", "Single Color"};
-    static int set_loc = 0;
-    static double llx = 0.0, lly = 0.0, llr = 1.0, llm = 0.0;
-    static int lls = 10;
-    static bool record_win = false;
-    static bool poli_win = false;
+    std::string path;
+    int width, height;
+    int columns, rows;
+    std::streamoff header = 0;
+    std::ofstream file;
+    int tiles_left = 0; // Only touched by the readback worker once the file is open
+};
 
-    ImGui::SetNextWindowPos(ImVec2(10, 10));
-    ImGui::SetNextWindowSize(ImVec2(300, 470));
-    ImGui::Begin("Settings", NULL,  ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoMove);
+// Captures are read into pixel pack buffers and written by a worker thread, so frame N is read back while
+// frame N + 1 computes instead of stalling right after the dispatch
+struct ReadbackSlot
+{
+    GLuint pbo = 0;
+    const float* mapped = nullptr; // Persistent, coherent
+    GLsync fence = nullptr;
+    std::string path;
+    int format = 0;                // Image format when it was taken
+    bool half = true;              // EXR color channels
+    bool has_de = false;           // EXR distance estimate plane
+    int frame = -1;                // Capture frame number, -1 for stills
+    unsigned iterations = 0;       // Limit of the iteration buffer it was colored from
+    FILE* stream = nullptr;        // Capture stream when it was taken, the UI thread opens and closes it
+    Poster* poster = nullptr;      // Tile of a poster instead of a file of its own
+    int tile = 0;
+    bool busy = false;             // Owned by the GPU or the worker until the file is written
+};
 
-    ImGui::Text("Alt-F4 to Exit");
+struct Readback
+{
+    ReadbackSlot slots[READBACK_SLOTS];
+    unsigned next = 0;
 
-    ImGui::Separator();
+    std::deque<ReadbackSlot*> gpu;  // Waiting on their fences, in submission order
+    std::deque<ReadbackSlot*> work; // Landed, for the worker to write out
 
-    ImGui::Text("Iterations [%u]", iterations);
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool quit = false;
+};
 
-    ImGui::SameLine();
-    if (ImGui::Button("+10"))
+Readback readback;
+
+// Planes of a 4:2:0 frame, chroma rounded up for odd sizes
+static size_t yuv420Size(int w, int h)
+{
+    return (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+}
+
+// BT.709 limited range 4:2:0, chroma from the average of each 2x2 block. Rows are flipped like convertRGB8.
+// With an odd size the last row and column stand in for the missing half of their blocks
+static void convertYUV420(const float* src, unsigned char* dst, int w, int h)
+{
+    const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    unsigned char* py = dst;
+    unsigned char* pu = dst + (size_t)w * h;
+    unsigned char* pv = pu + (size_t)cw * ch;
+
+    for(int y = 0; y < h; y += 2)
     {
-        iterations += 10;
-        if(iterations > 1000000) iterations = 1000000;
+        const int y1 = std::min(y + 1, h - 1);
+        const float* rows[2] = { src + (size_t)(h - 1 - y) * w * 4, src + (size_t)(h - 1 - y1) * w * 4 };
+        unsigned char* ys[2] = { py + (size_t)y * w, py + (size_t)y1 * w };
+        unsigned char* us = pu + (size_t)(y / 2) * cw;
+        unsigned char* vs = pv + (size_t)(y / 2) * cw;
+        int x = 0;
+
+#ifdef HAVE_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        for(; x + 4 <= w; x += 4)
+        {
+            __m128 sr = zero, sg = zero, sb = zero;
+
+            for(int k = 0; k < 2; k++)
+            {
+                __m128 r = _mm_loadu_ps(rows[k] + 4 * x);
+                __m128 g = _mm_loadu_ps(rows[k] + 4 * x + 4);
+                __m128 b = _mm_loadu_ps(rows[k] + 4 * x + 8);
+                __m128 a = _mm_loadu_ps(rows[k] + 4 * x + 12);
+                _MM_TRANSPOSE4_PS(r, g, b, a);
+
+                r = _mm_min_ps(_mm_max_ps(r, zero), one);
+                g = _mm_min_ps(_mm_max_ps(g, zero), one);
+                b = _mm_min_ps(_mm_max_ps(b, zero), one);
+
+                __m128 luma = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.2126f * 219.0f)), _mm_mul_ps(g, _mm_set1_ps(0.7152f * 219.0f))),
+                    _mm_add_ps(_mm_mul_ps(b, _mm_set1_ps(0.0722f * 219.0f)), _mm_set1_ps(16.0f)));
+                __m128i yi = _mm_cvtps_epi32(luma);
+                yi = _mm_packus_epi16(_mm_packs_epi32(yi, yi), yi);
+                int y4 = _mm_cvtsi128_si32(yi);
+                memcpy(ys[k] + x, &y4, 4);
+
+                sr = _mm_add_ps(sr, r);
+                sg = _mm_add_ps(sg, g);
+                sb = _mm_add_ps(sb, b);
+            }
+
+            // Pair up neighbouring columns, lanes 0 and 2 hold the two block sums
+            sr = _mm_add_ps(sr, _mm_shuffle_ps(sr, sr, _MM_SHUFFLE(2, 3, 0, 1)));
+            sg = _mm_add_ps(sg, _mm_shuffle_ps(sg, sg, _MM_SHUFFLE(2, 3, 0, 1)));
+            sb = _mm_add_ps(sb, _mm_shuffle_ps(sb, sb, _MM_SHUFFLE(2, 3, 0, 1)));
+
+            __m128 quarter = _mm_set1_ps(0.25f);
+            sr = _mm_mul_ps(sr, quarter);
+            sg = _mm_mul_ps(sg, quarter);
+            sb = _mm_mul_ps(sb, quarter);
+
+            __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sr, _mm_set1_ps(0.2126f)), _mm_mul_ps(sg, _mm_set1_ps(0.7152f))), _mm_mul_ps(sb, _mm_set1_ps(0.0722f)));
+            __m128 cb = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(sb, l), _mm_set1_ps(224.0f / 1.8556f)), _mm_set1_ps(128.0f));
+            __m128 cr = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(sr, l), _mm_set1_ps(224.0f / 1.5748f)), _mm_set1_ps(128.0f));
+
+            float c[2][4];
+            _mm_storeu_ps(c[0], cb);
+            _mm_storeu_ps(c[1], cr);
+
+            us[x / 2] = (unsigned char)(c[0][0] + 0.5f);
+            us[x / 2 + 1] = (unsigned char)(c[0][2] + 0.5f);
+            vs[x / 2] = (unsigned char)(c[1][0] + 0.5f);
+            vs[x / 2 + 1] = (unsigned char)(c[1][2] + 0.5f);
+        }
+#endif
+
+        for(; x < w; x += 2)
+        {
+            float sum[3] = { 0.0f, 0.0f, 0.0f };
+
+            for(int k = 0; k < 2; k++)
+            {
+                for(int j = 0; j < 2; j++)
+                {
+                    const int xj = std::min(x + j, w - 1);
+                    const float* p = rows[k] + 4 * (size_t)xj;
+                    float r = std::clamp(p[0], 0.0f, 1.0f);
+                    float g = std::clamp(p[1], 0.0f, 1.0f);
+                    float b = std::clamp(p[2], 0.0f, 1.0f);
+
+                    ys[k][xj] = (unsigned char)(16.0f + 219.0f * (0.2126f * r + 0.7152f * g + 0.0722f * b) + 0.5f);
+                    sum[0] += r;
+                    sum[1] += g;
+                    sum[2] += b;
+                }
+            }
+
+            float r = sum[0] * 0.25f, g = sum[1] * 0.25f, b = sum[2] * 0.25f;
+            float l = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+            us[x / 2] = (unsigned char)(128.0f + 224.0f / 1.8556f * (b - l) + 0.5f);
+            vs[x / 2] = (unsigned char)(128.0f + 224.0f / 1.5748f * (r - l) + 0.5f);
+        }
     }
+}
 
-    ImGui::SameLine();
-    if (ImGui::Button("-10"))
+static void writeY4MFrame(const float* data, int frame, unsigned iterations, FILE* stream)
+{
+    FrameBuffer* buf = acquireFrameBuffer();
+    buf->stream = stream;
+
+    static const char header[] = "FRAME\n";
+    size_t header_size = sizeof(header) - 1;
+
+    buf->size = header_size + yuv420Size(T_SIZE_W, T_SIZE_H);
+    buf->data.resize(buf->size);
+    buf->path.clear();
+
+    memcpy(buf->data.data(), header, header_size);
+    convertYUV420(data, buf->data.data() + header_size, T_SIZE_W, T_SIZE_H);
+
+    submitFrameBuffer(buf, frame, iterations);
+}
+
+static void writePPM(const float* data, const std::string& path, int frame, unsigned iterations)
+{
+    FrameBuffer* buf = acquireFrameBuffer();
+
+    char header[32];
+    int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", T_SIZE_W, T_SIZE_H);
+
+    buf->size = header_size + (size_t)T_SIZE_W * T_SIZE_H * 3;
+    buf->data.resize(buf->size + 1);
+    buf->path = path;
+
+    memcpy(buf->data.data(), header, header_size);
+    convertRGB8(data, buf->data.data() + header_size, T_SIZE_W, T_SIZE_H);
+
+    submitFrameBuffer(buf, frame, iterations);
+}
+
+// Lossless encoders for captures and stills. No zlib around, so PNG gets its own deflate: the image is cut
+// in stripes that are filtered and compressed in parallel, each ending on a byte boundary (like a sync
+// flush) so the streams just concatenate, with the adler32 of the stripes combined at the end
+static uint32_t crc32(uint32_t crc, const unsigned char* p, size_t n)
+{
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for(size_t i = 0; i < n; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t adler32(const unsigned char* p, size_t n)
+{
+    uint32_t a = 1, b = 0;
+
+    while(n > 0)
+    {
+        // Largest run that can't overflow before the modulo
+        size_t run = std::min(n, (size_t)5552);
+        for(size_t i = 0; i < run; i++)
+        {
+            a += p[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        p += run;
+        n -= run;
+    }
+
+    return (b << 16) | a;
+}
+
+// Adler32 of two concatenated buffers from the ones of each, len2 is the size of the second
+static uint32_t adler32Combine(uint32_t a1, uint32_t a2, size_t len2)
+{
+    const uint32_t base = 65521;
+    uint32_t rem = (uint32_t)(len2 % base);
+    uint32_t sum1 = a1 & 0xFFFF;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % base);
+
+    sum1 += (a2 & 0xFFFF) + base - 1;
+    sum2 += ((a1 >> 16) & 0xFFFF) + ((a2 >> 16) & 0xFFFF) + base - rem;
+    if(sum1 >= base) sum1 -= base;
+    if(sum1 >= base) sum1 -= base;
+    if(sum2 >= (base << 1)) sum2 -= (base << 1);
+    if(sum2 >= base) sum2 -= base;
+
+    return sum1 | (sum2 << 16);
+}
+
+struct BitWriter
+{
+    std::vector<unsigned char>& out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    BitWriter(std::vector<unsigned char>& o) : out(o) {}
+
+    void put(uint32_t v, int n)
+    {
+        bits |= (uint64_t)v << count;
+        count += n;
+        while(count >= 8)
+        {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void align()
+    {
+        if(count > 0)
+            out.push_back((unsigned char)bits);
+        bits = 0;
+        count = 0;
+    }
+};
+
+// Huffman code lengths limited to limit bits, flattening the frequencies until the tree fits
+static void huffmanLengths(const uint32_t* freq, int n, int limit, uint8_t* lengths)
+{
+    std::vector<uint32_t> f(freq, freq + n);
+
+    // A single used symbol still needs a complete code
+    int used = 0;
+    for(int i = 0; i < n; i++)
+        used += f[i] > 0;
+    for(int i = 0; i < n && used < 2; i++)
+    {
+        if(f[i] == 0)
+        {
+            f[i] = 1;
+            used++;
+        }
+    }
+
+    while(true)
+    {
+        // Leaves are 0..n-1, internal nodes come after
+        std::vector<int> parent(2 * n, -1);
+        std::priority_queue<std::pair<uint64_t, int>, std::vector<std::pair<uint64_t, int>>, std::greater<std::pair<uint64_t, int>>> q;
+
+        for(int i = 0; i < n; i++)
+            if(f[i] > 0)
+                q.push({ f[i], i });
+
+        int next = n;
+        while(q.size() > 1)
+        {
+            auto a = q.top(); q.pop();
+            auto b = q.top(); q.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            q.push({ a.first + b.first, next++ });
+        }
+
+        int longest = 0;
+        for(int i = 0; i < n; i++)
+        {
+            int depth = 0;
+            if(f[i] > 0)
+                for(int p = parent[i]; p >= 0; p = parent[p])
+                    depth++;
+            lengths[i] = (uint8_t)depth;
+            longest = std::max(longest, depth);
+        }
+
+        if(longest <= limit)
+            return;
+
+        for(int i = 0; i < n; i++)
+            if(f[i] > 0)
+                f[i] = (f[i] >> 1) | 1;
+    }
+}
+
+// Canonical codes, bit reversed since deflate sends Huffman codes starting from the top bit
+static void huffmanCodes(const uint8_t* lengths, int n, uint16_t* codes)
+{
+    int count[16] = {};
+    int next[16] = {};
+
+    for(int i = 0; i < n; i++)
+        count[lengths[i]]++;
+    count[0] = 0;
+
+    for(int b = 1, code = 0; b < 16; b++)
+    {
+        code = (code + count[b - 1]) << 1;
+        next[b] = code;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        int len = lengths[i];
+        if(len == 0)
+            continue;
+
+        int c = next[len]++;
+        int r = 0;
+        for(int k = 0; k < len; k++)
+            r |= ((c >> k) & 1) << (len - 1 - k);
+        codes[i] = (uint16_t)r;
+    }
+}
+
+static const uint16_t length_base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+struct LZToken
+{
+    uint16_t len;  // Literal byte when dist is 0
+    uint16_t dist;
+};
+
+static int lengthCode(int len)
+{
+    int c = 0;
+    while(c < 28 && length_base[c + 1] <= len)
+        c++;
+    return c;
+}
+
+static int distCode(int dist)
+{
+    int c = 0;
+    while(c < 29 && dist_base[c + 1] <= dist)
+        c++;
+    return c;
+}
+
+// One dynamic Huffman block
+static void deflateBlock(BitWriter& bw, const LZToken* tokens, size_t n, bool last)
+{
+    uint32_t lfreq[286] = {}, dfreq[30] = {};
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(tokens[i].dist == 0)
+        {
+            lfreq[tokens[i].len]++;
+        }
+        else
+        {
+            lfreq[257 + lengthCode(tokens[i].len)]++;
+            dfreq[distCode(tokens[i].dist)]++;
+        }
+    }
+    lfreq[256] = 1;
+
+    uint8_t llen[286], dlen[30];
+    uint16_t lcode[286] = {}, dcode[30] = {};
+    huffmanLengths(lfreq, 286, 15, llen);
+    huffmanLengths(dfreq, 30, 15, dlen);
+    huffmanCodes(llen, 286, lcode);
+    huffmanCodes(dlen, 30, dcode);
+
+    int hlit = 286, hdist = 30;
+    while(hlit > 257 && llen[hlit - 1] == 0) hlit--;
+    while(hdist > 1 && dlen[hdist - 1] == 0) hdist--;
+
+    // Code lengths of both trees, run length coded with 16 (repeat last), 17 and 18 (zeros)
+    std::vector<uint8_t> all(llen, llen + hlit);
+    all.insert(all.end(), dlen, dlen + hdist);
+
+    std::vector<std::pair<uint8_t, uint8_t>> rle;
+    for(size_t i = 0; i < all.size();)
+    {
+        size_t run = 1;
+        while(i + run < all.size() && all[i + run] == all[i])
+            run++;
+
+        if(all[i] == 0 && run >= 3)
+        {
+            size_t r = std::min(run, (size_t)138);
+            rle.push_back(r >= 11 ? std::make_pair((uint8_t)18, (uint8_t)(r - 11)) : std::make_pair((uint8_t)17, (uint8_t)(r - 3)));
+            i += r;
+        }
+        else if(all[i] != 0 && run >= 4)
+        {
+            size_t r = std::min(run - 1, (size_t)6);
+            rle.push_back({ all[i], 0 });
+            rle.push_back({ 16, (uint8_t)(r - 3) });
+            i += r + 1;
+        }
+        else
+        {
+            rle.push_back({ all[i], 0 });
+            i++;
+        }
+    }
+
+    uint32_t cfreq[19] = {};
+    for(auto& r : rle)
+        cfreq[r.first]++;
+
+    uint8_t clen[19];
+    uint16_t ccode[19] = {};
+    huffmanLengths(cfreq, 19, 7, clen);
+    huffmanCodes(clen, 19, ccode);
+
+    static const int order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int hclen = 19;
+    while(hclen > 4 && clen[order[hclen - 1]] == 0) hclen--;
+
+    bw.put(last ? 1 : 0, 1);
+    bw.put(2, 2);
+    bw.put(hlit - 257, 5);
+    bw.put(hdist - 1, 5);
+    bw.put(hclen - 4, 4);
+    for(int i = 0; i < hclen; i++)
+        bw.put(clen[order[i]], 3);
+
+    for(auto& r : rle)
+    {
+        bw.put(ccode[r.first], clen[r.first]);
+        if(r.first == 16) bw.put(r.second, 2);
+        else if(r.first == 17) bw.put(r.second, 3);
+        else if(r.first == 18) bw.put(r.second, 7);
+    }
+
+    for(size_t i = 0; i < n; i++)
+    {
+        const LZToken& t = tokens[i];
+        if(t.dist == 0)
+        {
+            bw.put(lcode[t.len], llen[t.len]);
+            continue;
+        }
+
+        int lc = lengthCode(t.len);
+        bw.put(lcode[257 + lc], llen[257 + lc]);
+        bw.put(t.len - length_base[lc], length_extra[lc]);
+
+        int dc = distCode(t.dist);
+        bw.put(dcode[dc], dlen[dc]);
+        bw.put(t.dist - dist_base[dc], dist_extra[dc]);
+    }
+
+    bw.put(lcode[256], llen[256]);
+}
+
+// Raw deflate of one stripe with greedy hash chain matching. Unless it is the last stripe it ends with
+// an empty stored block, which leaves the stream byte aligned for the next stripe
+static void deflateStripe(const unsigned char* in, size_t n, bool last, std::vector<unsigned char>& out)
+{
+    const int hash_bits = 15;
+    const size_t window = 32768;
+    const int max_chain = 32;
+    const size_t block_tokens = 1 << 16;
+
+    std::vector<int> head(1 << hash_bits, -1);
+    std::vector<int> prev(n);
+    std::vector<LZToken> tokens;
+    tokens.reserve(block_tokens);
+    BitWriter bw(out);
+
+    auto hash = [&](size_t i) { return ((in[i] << 10) ^ (in[i + 1] << 5) ^ in[i + 2]) & ((1 << hash_bits) - 1); };
+    auto insert = [&](size_t i) {
+        if(i + 3 > n)
+            return;
+        int h = hash(i);
+        prev[i] = head[h];
+        head[h] = (int)i;
+    };
+
+    for(size_t i = 0; i < n;)
+    {
+        size_t best = 0, best_dist = 0;
+
+        if(i + 3 <= n)
+        {
+            size_t max_len = std::min((size_t)258, n - i);
+            int chain = 0;
+            for(int j = head[hash(i)]; j >= 0 && i - j <= window && chain < max_chain; j = prev[j], chain++)
+            {
+                size_t len = 0;
+                while(len < max_len && in[j + len] == in[i + len])
+                    len++;
+
+                if(len > best)
+                {
+                    best = len;
+                    best_dist = i - j;
+                    if(len == max_len)
+                        break;
+                }
+            }
+        }
+
+        if(best >= 3)
+        {
+            tokens.push_back({ (uint16_t)best, (uint16_t)best_dist });
+            for(size_t k = 0; k < best; k++)
+                insert(i + k);
+            i += best;
+        }
+        else
+        {
+            tokens.push_back({ in[i], 0 });
+            insert(i);
+            i++;
+        }
+
+        if(tokens.size() == block_tokens)
+        {
+            deflateBlock(bw, tokens.data(), tokens.size(), false);
+            tokens.clear();
+        }
+    }
+
+    deflateBlock(bw, tokens.data(), tokens.size(), last);
+
+    if(!last)
+    {
+        bw.put(0, 3);
+        bw.align();
+        const unsigned char sync[] = { 0x00, 0x00, 0xFF, 0xFF };
+        out.insert(out.end(), sync, sync + 4);
+    }
+    else
+    {
+        bw.align();
+    }
+}
+
+static void pngPut32(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+static void pngChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t n, uint32_t crc)
+{
+    pngPut32(out, (uint32_t)n);
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + n);
+    pngPut32(out, crc);
+}
+
+// Filter type per row picked by the smallest sum of absolute values, the usual heuristic
+static void pngFilterRow(const unsigned char* row, const unsigned char* up, size_t n, unsigned char* out)
+{
+    static thread_local std::vector<unsigned char> cand[5];
+    uint64_t best_sum = ~0ull;
+    int best = 0;
+
+    for(int f = 0; f < 5; f++)
+    {
+        cand[f].resize(n);
+        uint64_t sum = 0;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            int a = i >= 3 ? row[i - 3] : 0;
+            int b = up ? up[i] : 0;
+            int c = (up && i >= 3) ? up[i - 3] : 0;
+            int pred = 0;
+
+            if(f == 1) pred = a;
+            else if(f == 2) pred = b;
+            else if(f == 3) pred = (a + b) / 2;
+            else if(f == 4)
+            {
+                int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+            }
+
+            unsigned char v = (unsigned char)(row[i] - pred);
+            cand[f][i] = v;
+            sum += v < 128 ? v : 256 - v;
+        }
+
+        if(sum < best_sum)
+        {
+            best_sum = sum;
+            best = f;
+        }
+    }
+
+    out[0] = (unsigned char)best;
+    memcpy(out + 1, cand[best].data(), n);
+}
+
+static void encodePNG(const unsigned char* rgb, int w, int h, std::vector<unsigned char>& out)
+{
+    static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    out.assign(signature, signature + 8);
+
+    unsigned char ihdr[13];
+    std::vector<unsigned char> tmp;
+    pngPut32(tmp, w);
+    pngPut32(tmp, h);
+    memcpy(ihdr, tmp.data(), 8);
+    ihdr[8] = 8;  // Bit depth
+    ihdr[9] = 2;  // RGB
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    uint32_t crc = crc32(crc32(0, (const unsigned char*)"IHDR", 4), ihdr, 13);
+    pngChunk(out, "IHDR", ihdr, 13, crc);
+
+    int stripes = std::clamp((int)std::thread::hardware_concurrency(), 1, 16);
+    stripes = std::min(stripes, h);
+
+    // Every stripe becomes its own IDAT chunk, the first carries the zlib header
+    struct Stripe
+    {
+        std::vector<unsigned char> data;
+        uint32_t adler;
+        size_t raw;
+        uint32_t crc;
+    };
+    std::vector<Stripe> parts(stripes);
+    std::vector<std::thread> threads;
+    const size_t stride = (size_t)w * 3;
+
+    for(int s = 0; s < stripes; s++)
+    {
+        threads.emplace_back([&, s] {
+            int y0 = h * s / stripes, y1 = h * (s + 1) / stripes;
+            std::vector<unsigned char> raw((size_t)(y1 - y0) * (stride + 1));
+
+            for(int y = y0; y < y1; y++)
+                pngFilterRow(rgb + y * stride, y > 0 ? rgb + (y - 1) * stride : nullptr, stride, raw.data() + (y - y0) * (stride + 1));
+
+            Stripe& p = parts[s];
+            if(s == 0)
+            {
+                p.data.push_back(0x78);
+                p.data.push_back(0x01);
+            }
+            deflateStripe(raw.data(), raw.size(), s == stripes - 1, p.data);
+
+            p.adler = adler32(raw.data(), raw.size());
+            p.raw = raw.size();
+            p.crc = crc32(crc32(0, (const unsigned char*)"IDAT", 4), p.data.data(), p.data.size());
+        });
+    }
+
+    for(std::thread& t : threads)
+        t.join();
+
+    uint32_t adler = parts[0].adler;
+    for(int s = 0; s < stripes; s++)
+    {
+        pngChunk(out, "IDAT", parts[s].data.data(), parts[s].data.size(), parts[s].crc);
+        if(s > 0)
+            adler = adler32Combine(adler, parts[s].adler, parts[s].raw);
+    }
+
+    // zlib trailer, a chunk of its own so the stripes didn't have to wait for it
+    tmp.clear();
+    pngPut32(tmp, adler);
+    pngChunk(out, "IDAT", tmp.data(), 4, crc32(crc32(0, (const unsigned char*)"IDAT", 4), tmp.data(), 4));
+
+    pngChunk(out, "IEND", nullptr, 0, crc32(0, (const unsigned char*)"IEND", 4));
+}
+
+// The Quite OK Image format, https://qoiformat.org, much faster than PNG and not far behind on fractals
+static void encodeQOI(const unsigned char* rgb, int w, int h, std::vector<unsigned char>& out)
+{
+    out.clear();
+    const unsigned char magic[] = { 'q', 'o', 'i', 'f' };
+    out.insert(out.end(), magic, magic + 4);
+    pngPut32(out, w);
+    pngPut32(out, h);
+    out.push_back(3);  // RGB
+    out.push_back(0);  // sRGB
+
+    unsigned char index[64][4] = {};
+    unsigned char px[3] = { 0, 0, 0 };
+    unsigned char prev[3] = { 0, 0, 0 };
+    int run = 0;
+    size_t n = (size_t)w * h;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        memcpy(px, rgb + 3 * i, 3);
+
+        if(memcmp(px, prev, 3) == 0)
+        {
+            run++;
+            if(run == 62 || i == n - 1)
+            {
+                out.push_back((unsigned char)(0xC0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+
+        if(run > 0)
+        {
+            out.push_back((unsigned char)(0xC0 | (run - 1)));
+            run = 0;
+        }
+
+        // Alpha is always 255
+        int h6 = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+
+        if(memcmp(index[h6], px, 3) == 0 && index[h6][3] == 255)
+        {
+            out.push_back((unsigned char)h6);
+        }
+        else
+        {
+            memcpy(index[h6], px, 3);
+            index[h6][3] = 255;
+
+            int dr = (signed char)(px[0] - prev[0]);
+            int dg = (signed char)(px[1] - prev[1]);
+            int db = (signed char)(px[2] - prev[2]);
+            int dr_dg = dr - dg, db_dg = db - dg;
+
+            if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                out.push_back((unsigned char)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+            }
+            else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+            {
+                out.push_back((unsigned char)(0x80 | (dg + 32)));
+                out.push_back((unsigned char)(((dr_dg + 8) << 4) | (db_dg + 8)));
+            }
+            else
+            {
+                out.push_back(0xFE);
+                out.insert(out.end(), px, px + 3);
+            }
+        }
+
+        memcpy(prev, px, 3);
+    }
+
+    const unsigned char end[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    out.insert(out.end(), end, end + 8);
+}
+
+// Round to nearest even, overflow goes to infinity and NaN stays NaN
+static uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, 4);
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mag = x & 0x7FFFFFFF;
+
+    if(mag >= 0x7F800000)
+        return (uint16_t)(sign | 0x7C00 | (mag > 0x7F800000 ? 0x200 : 0));
+
+    // Largest value that doesn't round up to infinity
+    if(mag >= 0x477FF000)
+        return (uint16_t)(sign | 0x7C00);
+
+    if(mag < 0x38800000)
+    {
+        // Denormal, shift the mantissa with the implicit bit in place
+        if(mag < 0x33000000)
+            return (uint16_t)sign;
+
+        uint32_t e = mag >> 23;
+        uint32_t m = (mag & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - e;
+        uint32_t h = m >> shift;
+        uint32_t rest = m & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if(rest > half || (rest == half && (h & 1)))
+            h++;
+        return (uint16_t)(sign | h);
+    }
+
+    uint32_t h = ((mag - 0x38000000) >> 13);
+    uint32_t rest = mag & 0x1FFF;
+    if(rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;
+    return (uint16_t)(sign | h);
+}
+
+// zlib stream of a whole buffer, the same deflate as the PNG stripes
+static void zlibCompress(const unsigned char* in, size_t n, std::vector<unsigned char>& out)
+{
+    out.clear();
+    out.push_back(0x78);
+    out.push_back(0x01);
+    deflateStripe(in, n, true, out);
+    pngPut32(out, adler32(in, n));
+}
+
+struct EXRChannel
+{
+    const char* name;
+    const float* src; // Rows bottom up, stride floats apart
+    int stride;
+    bool half;
+};
+
+static void exrPut32(std::vector<unsigned char>& out, uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+        out.push_back((unsigned char)(v >> (8 * i)));
+}
+
+static void exrAttribute(std::vector<unsigned char>& out, const char* name, const char* type, const std::vector<unsigned char>& value)
+{
+    out.insert(out.end(), name, name + strlen(name) + 1);
+    out.insert(out.end(), type, type + strlen(type) + 1);
+    exrPut32(out, (uint32_t)value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// Scanline OpenEXR with ZIP compression, blocks of 16 lines compressed in parallel. Channels must come
+// sorted by name
+static void encodeEXR(const std::vector<EXRChannel>& channels, int w, int h, std::vector<unsigned char>& out)
+{
+    const int block_lines = 16;
+    const int blocks = (h + block_lines - 1) / block_lines;
+
+    out.clear();
+    exrPut32(out, 20000630);
+    exrPut32(out, 2);
+
+    std::vector<unsigned char> v;
+    for(const EXRChannel& c : channels)
+    {
+        v.insert(v.end(), c.name, c.name + strlen(c.name) + 1);
+        exrPut32(v, c.half ? 1 : 2);
+        exrPut32(v, 0); // pLinear and reserved
+        exrPut32(v, 1);
+        exrPut32(v, 1);
+    }
+    v.push_back(0);
+    exrAttribute(out, "channels", "chlist", v);
+
+    exrAttribute(out, "compression", "compression", { 3 });
+
+    v.clear();
+    exrPut32(v, 0);
+    exrPut32(v, 0);
+    exrPut32(v, w - 1);
+    exrPut32(v, h - 1);
+    exrAttribute(out, "dataWindow", "box2i", v);
+    exrAttribute(out, "displayWindow", "box2i", v);
+
+    exrAttribute(out, "lineOrder", "lineOrder", { 0 });
+
+    float one = 1.0f;
+    v.resize(4);
+    memcpy(v.data(), &one, 4);
+    exrAttribute(out, "pixelAspectRatio", "float", v);
+    exrAttribute(out, "screenWindowWidth", "float", v);
+    exrAttribute(out, "screenWindowCenter", "v2f", std::vector<unsigned char>(8, 0));
+    out.push_back(0);
+
+    std::vector<std::vector<unsigned char>> chunks(blocks);
+    int threads_n = std::clamp((int)std::thread::hardware_concurrency(), 1, 16);
+    threads_n = std::min(threads_n, blocks);
+    std::vector<std::thread> threads;
+
+    for(int t = 0; t < threads_n; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::vector<unsigned char> raw, split, packed;
+
+            for(int b = t; b < blocks; b += threads_n)
+            {
+                int y0 = b * block_lines, y1 = std::min(y0 + block_lines, h);
+
+                // Each line holds every channel in turn, top down as lineOrder says
+                raw.clear();
+                for(int y = y0; y < y1; y++)
+                {
+                    for(const EXRChannel& c : channels)
+                    {
+                        const float* row = c.src + (size_t)(h - 1 - y) * w * c.stride;
+                        for(int x = 0; x < w; x++)
+                        {
+                            float f = row[(size_t)x * c.stride];
+                            if(c.half)
+                            {
+                                uint16_t hv = floatToHalf(f);
+                                raw.push_back((unsigned char)hv);
+                                raw.push_back((unsigned char)(hv >> 8));
+                            }
+                            else
+                            {
+                                unsigned char bytes[4];
+                                memcpy(bytes, &f, 4);
+                                raw.insert(raw.end(), bytes, bytes + 4);
+                            }
+                        }
+                    }
+                }
+
+                // ZIP predictor, low bytes in the first half and high bytes in the second, then deltas
+                size_t n = raw.size();
+                split.resize(n);
+                for(size_t i = 0; i < n; i++)
+                    split[(i & 1) ? (n + 1) / 2 + i / 2 : i / 2] = raw[i];
+
+                int p = split[0];
+                for(size_t i = 1; i < n; i++)
+                {
+                    int d = split[i];
+                    split[i] = (unsigned char)(d - p + 384);
+                    p = d;
+                }
+
+                zlibCompress(split.data(), n, packed);
+
+                // Blocks that don't shrink are stored as they are
+                const std::vector<unsigned char>& data = packed.size() < n ? packed : raw;
+                std::vector<unsigned char>& chunk = chunks[b];
+                chunk.clear();
+                exrPut32(chunk, y0);
+                exrPut32(chunk, (uint32_t)data.size());
+                chunk.insert(chunk.end(), data.begin(), data.end());
+            }
+        });
+    }
+
+    for(std::thread& t : threads)
+        t.join();
+
+    uint64_t offset = out.size() + (uint64_t)blocks * 8;
+    for(int b = 0; b < blocks; b++)
+    {
+        exrPut32(out, (uint32_t)offset);
+        exrPut32(out, (uint32_t)(offset >> 32));
+        offset += chunks[b].size();
+    }
+
+    for(const std::vector<unsigned char>& chunk : chunks)
+        out.insert(out.end(), chunk.begin(), chunk.end());
+}
+
+// Frame and still files, 0 PPM, 1 PNG, 2 QOI, 3 EXR with the iteration buffer and distance estimate
+int image_format = 0;
+static const char* image_extensions[] = {".ppm", ".png", ".qoi", ".exr"};
+
+// Index into image_extensions, -1 for none of them
+static int imageFormatOf(const std::string& path)
+{
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+    for(int i = 0; i < 4; i++)
+        if(ext == image_extensions[i])
+            return i;
+    return -1;
+}
+bool exr_half = true;
+
+// Opens the file at the full size of the poster, under a temporary name until the last tile is in
+static bool openPoster(Poster* p)
+{
+    char header[48];
+    int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", p->width, p->height);
+
+    p->columns = (p->width + T_SIZE_W - 1) / T_SIZE_W;
+    p->rows = (p->height + T_SIZE_H - 1) / T_SIZE_H;
+    p->tiles_left = p->columns * p->rows;
+    p->header = header_size;
+
+    p->file.open(p->path + ".part", std::ios::binary | std::ios::trunc);
+    p->file.write(header, header_size);
+    p->file.seekp(p->header + (std::streamoff)p->width * p->height * 3 - 1);
+    p->file.put(0);
+    return p->file.good();
+}
+
+static void writePosterTile(const ReadbackSlot* slot)
+{
+    Poster* p = slot->poster;
+    static thread_local std::vector<unsigned char> rgb;
+    rgb.resize((size_t)T_SIZE_W * T_SIZE_H * 3 + 1);
+    convertRGB8(slot->mapped, rgb.data(), T_SIZE_W, T_SIZE_H);
+
+    // Tiles on the right and top edges hang over the poster
+    int x0 = slot->tile % p->columns * T_SIZE_W;
+    int y0 = slot->tile / p->columns * T_SIZE_H;
+    int w = std::min(T_SIZE_W, p->width - x0);
+    int h = std::min(T_SIZE_H, p->height - y0);
+
+    // Rows counted from the bottom, the converted ones and the file go from the top
+    for(int y = 0; y < h; y++)
+    {
+        std::streamoff row = p->height - 1 - (y0 + y);
+        p->file.seekp(p->header + (row * p->width + x0) * 3);
+        p->file.write((const char*)rgb.data() + (size_t)(T_SIZE_H - 1 - y) * T_SIZE_W * 3, (size_t)w * 3);
+    }
+
+    if(--p->tiles_left > 0)
+        return;
+
+    p->file.close();
+    std::error_code ec;
+    if(!p->file.fail())
+        std::filesystem::rename(p->path + ".part", p->path, ec);
+    if(p->file.fail() || ec)
+        std::cerr << "Could not write file: " << p->path << std::endl;
+}
+
+static void writeImage(const ReadbackSlot* slot)
+{
+    const float* data = slot->mapped;
+    const std::string& path = slot->path;
+
+    if(slot->poster)
+    {
+        writePosterTile(slot);
+        return;
+    }
+
+    if(slot->format == 0)
+    {
+        writePPM(data, path, slot->frame, slot->iterations);
+        return;
+    }
+
+    if(slot->format == 3)
+    {
+        const size_t plane = (size_t)T_SIZE_W * T_SIZE_H;
+        std::vector<EXRChannel> channels = {
+            { "B", data + 2, 4, slot->half },
+            { "G", data + 1, 4, slot->half },
+            { "R", data + 0, 4, slot->half },
+        };
+        if(slot->has_de)
+            channels.push_back({ "de", data + plane * 5, 1, false });
+        channels.push_back({ "iter", data + plane * 4, 1, false });
+
+        FrameBuffer* buf = acquireFrameBuffer();
+        buf->path = path;
+        encodeEXR(channels, T_SIZE_W, T_SIZE_H, buf->data);
+        buf->size = buf->data.size();
+        submitFrameBuffer(buf, slot->frame, slot->iterations);
+        return;
+    }
+
+    static thread_local std::vector<unsigned char> rgb;
+    rgb.resize((size_t)T_SIZE_W * T_SIZE_H * 3 + 1);
+    convertRGB8(data, rgb.data(), T_SIZE_W, T_SIZE_H);
+
+    FrameBuffer* buf = acquireFrameBuffer();
+    buf->path = path;
+
+    if(slot->format == 1)
+        encodePNG(rgb.data(), T_SIZE_W, T_SIZE_H, buf->data);
+    else
+        encodeQOI(rgb.data(), T_SIZE_W, T_SIZE_H, buf->data);
+
+    buf->size = buf->data.size();
+    submitFrameBuffer(buf, slot->frame, slot->iterations);
+}
+
+static void readbackWorker()
+{
+    std::unique_lock<std::mutex> l(readback.lock);
+
+    while(true)
+    {
+        readback.cv.wait(l, [] { return readback.quit || !readback.work.empty(); });
+
+        if(readback.work.empty())
+            return;
+
+        ReadbackSlot* slot = readback.work.front();
+        readback.work.pop_front();
+
+        l.unlock();
+        if(slot->stream)
+            writeY4MFrame(slot->mapped, slot->frame, slot->iterations, slot->stream);
+        else
+            writeImage(slot);
+        l.lock();
+
+        slot->busy = false;
+        readback.cv.notify_all();
+    }
+}
+
+static void initReadback()
+{
+    // RGBA, then the iteration and distance estimate planes for EXR
+    const GLsizeiptr size = (GLsizeiptr)T_SIZE_W * T_SIZE_H * 6 * sizeof(float);
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    for(ReadbackSlot& slot : readback.slots)
+    {
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferStorage(GL_PIXEL_PACK_BUFFER, size, NULL, flags);
+        slot.mapped = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.worker = std::thread(readbackWorker);
+    initWriter();
+}
+
+// Hands every frame that already landed to the worker, blocks for the oldest one if wait is set
+static void pollReadback(bool wait)
+{
+    while(!readback.gpu.empty())
+    {
+        ReadbackSlot* slot = readback.gpu.front();
+        GLenum r = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+
+        if(r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+            return;
+
+        glDeleteSync(slot->fence);
+        slot->fence = nullptr;
+        readback.gpu.pop_front();
+
+        std::lock_guard<std::mutex> l(readback.lock);
+        readback.work.push_back(slot);
+        readback.cv.notify_all();
+
+        // Only the oldest one is waited for, the rest go if they already landed
+        wait = false;
+    }
+}
+
+// Every submitted frame is on disk after this
+static void finishReadback()
+{
+    while(!readback.gpu.empty())
+        pollReadback(true);
+
+    std::unique_lock<std::mutex> l(readback.lock);
+    readback.cv.wait(l, [] {
+        for(const ReadbackSlot& slot : readback.slots)
+            if(slot.busy)
+                return false;
+        return true;
+    });
+    l.unlock();
+
+    finishWriter();
+}
+
+// Capture output, 0 numbered image files, 1 a Y4M file, 2 Y4M on stdout for piping into an encoder
+int capture_format = 0;
+int capture_fps = 60;
+int capture_frame = 0; // Number of the next frame saved
+std::streambuf* cout_buf = nullptr;
+
+static std::string y4mHeader()
+{
+    char header[128];
+    snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n", T_SIZE_W, T_SIZE_H, capture_fps);
+    return header;
+}
+
+static size_t y4mFrameBytes()
+{
+    return 6 + yuv420Size(T_SIZE_W, T_SIZE_H);
+}
+
+// Starts a Y4M stream for the capture about to run, frames then skip the per frame files. A resumed file
+// is cut back to its first frames and appended to
+static void openCaptureStream(int first)
+{
+    if(capture_format == 0)
+        return;
+
+    if(!readback.worker.joinable())
+        initReadback();
+
+    FILE* out;
+    if(capture_format == 2)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        // Logging has to stay out of the video
+        cout_buf = std::cout.rdbuf(std::cerr.rdbuf());
+        out = stdout;
+    }
+    else
+    {
+        auto path = std::filesystem::current_path() / (std::to_string(epoch_min) + ".y4m");
+        std::error_code ec;
+        if(first > 0)
+            std::filesystem::resize_file(path, y4mHeader().size() + first * y4mFrameBytes(), ec);
+        out = fopen(path.string().c_str(), first > 0 && !ec ? "ab" : "wb");
+        if(ec)
+            first = 0;
+    }
+
+    if(!out)
+    {
+        std::cerr << "Could not open the capture stream" << std::endl;
+        return;
+    }
+
+    if(first == 0)
+        fputs(y4mHeader().c_str(), out);
+    writer.stream = out;
+}
+
+// After finishReadback
+static void closeCaptureStream()
+{
+    if(!writer.stream)
+        return;
+
+    if(writer.stream == stdout)
+    {
+        fflush(stdout);
+        std::cout.rdbuf(cout_buf);
+    }
+    else
+        fclose(writer.stream);
+
+    writer.stream = nullptr;
+}
+
+// Next numbered frame of the capture unless a path is given, or a tile of the poster
+void saveFBOImage(InitData& idata, const std::string& path = "", Poster* poster = nullptr, int tile = 0)
+{
+    if(!readback.worker.joinable())
+        initReadback();
+
+    auto dirname = std::filesystem::current_path() / std::to_string(epoch_min).c_str();
+
+    if(!writer.stream && path.empty())
+        std::filesystem::create_directory(dirname);
+
+    ReadbackSlot* slot = &readback.slots[readback.next];
+    readback.next = (readback.next + 1) % READBACK_SLOTS;
+
+    // All slots in flight, wait for the oldest one to be written
+    if(slot->fence)
+        pollReadback(true);
+
+    {
+        std::unique_lock<std::mutex> l(readback.lock);
+        readback.cv.wait(l, [slot] { return !slot->busy; });
+        slot->busy = true;
+    }
+
+    if(path.empty())
+    {
+        slot->frame = capture_frame++;
+        slot->path = dirname.string() + "/frame" + std::to_string(slot->frame) + image_extensions[image_format];
+    }
+    else
+    {
+        slot->frame = -1;
+        slot->path = path;
+    }
+
+    resolveColor(idata);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, idata.color_texture);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, 0);
+
+    slot->format = image_format;
+    slot->half = exr_half;
+    slot->has_de = dist_est;
+    slot->iterations = buffer_iterations;
+    slot->stream = path.empty() ? writer.stream : nullptr;
+    slot->poster = poster;
+    slot->tile = tile;
+
+    if(image_format == 3 && !poster)
+    {
+        const size_t plane = (size_t)T_SIZE_W * T_SIZE_H * sizeof(float);
+
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, idata.iter_texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, (void*)(plane * 4));
+
+        if(dist_est)
+        {
+            glBindTexture(GL_TEXTURE_2D, idata.de_texture);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, (void*)(plane * 5));
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.gpu.push_back(slot);
+
+    pollReadback(false);
+}
+
+static void shutdownReadback()
+{
+    if(!readback.worker.joinable())
+        return;
+
+    finishReadback();
+
+    {
+        std::lock_guard<std::mutex> l(readback.lock);
+        readback.quit = true;
+        readback.cv.notify_all();
+    }
+    readback.worker.join();
+    shutdownWriter();
+
+    for(ReadbackSlot& slot : readback.slots)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glDeleteBuffers(1, &slot.pbo);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void CleanUp(InitData& d)
+{
+    glDeleteProgram(d.compute_program);
+    glDeleteProgram(d.render_program);
+    glDeleteProgram(d.resample_program);
+    glDeleteProgram(d.hist_program);
+    glDeleteProgram(d.cdf_program);
+    glDeleteProgram(d.keyframe_program);
+
+    glDeleteTextures(1, &d.iter_texture);
+    glDeleteTextures(1, &d.back_iter_texture);
+    glDeleteTextures(1, &d.color_texture);
+    glDeleteTextures(1, &d.palette_texture);
+    glDeleteTextures(1, &d.aa_texture);
+    glDeleteTextures(1, &d.aa_count_texture);
+    glDeleteTextures(1, &d.accum_texture);
+    glDeleteTextures(1, &d.de_texture);
+    glDeleteTextures(1, &d.key_texture);
+    glDeleteTextures(1, &d.key_de_texture);
+
+    glDeleteFramebuffers(1, &d.accum_fb);
+
+    glDeleteBuffers(1, d.cs_ssbo);
+    glDeleteBuffers(1, &d.rect_vbo);
+    glDeleteBuffers(1, &d.hist_ssbo);
+    glDeleteBuffers(1, &d.cdf_ssbo);
+    glDeleteBuffers(1, &d.stats_ssbo);
+
+    glDeleteVertexArrays(1, &d.rect_vao);
+}
+
+
+bool dispatchDone = false;
+double curr_mag = 1.0;
+double min_mag = 1.0f;
+double max_mag = 1.0f;
+float mult_frame = 2.0f;
+unsigned number_frames = 0;
+unsigned c_frame = 0;
+bool capture_dispatched = false; // The frame dispatched for a capture wasn't saved yet
+std::chrono::steady_clock::time_point tp;
+std::chrono::steady_clock::time_point ltp;
+
+// Everything the iteration buffer depends on
+struct ViewState
+{
+    double lx, ly;
+    double scroll;
+    unsigned iterations;
+    unsigned set;
+    bool d_prec;
+    bool smooth_it;
+    bool dist_est;
+};
+
+ViewState last_view;
+bool last_view_valid = false;
+unsigned long long last_dispatch_px = 0;
+unsigned long long last_reused_px = 0;
+
+struct Tile
+{
+    GLint x, y;
+    GLint w, h;
+};
+
+// Progressive refinement of the current view, one pass per stride, coarse to fine
+struct RenderJob
+{
+    std::vector<Tile> tiles;
+    std::vector<int> strides;
+    size_t pass = 0;
+    size_t next = 0;
+    bool done = true;
+    unsigned generation = 0;
+    std::chrono::steady_clock::time_point start;
+    double time_ms = 0.0;
+
+    // Cursor in texture pixels, and how long the tile under it took to be final (-1 while it isn't)
+    double cursor_x = 0.0, cursor_y = 0.0;
+    int cursor_tile = -1;
+    double cursor_ms = -1.0;
+
+    // Frame statistics were already used to adapt the iteration limit
+    bool adapted = false;
+
+    // Supersampling rounds run over the finished view
+    int aa_round = 0;
+};
+
+enum class PassOrder
+{
+    SCANLINE,
+    SPIRAL,
+    CURSOR,
+    CENTER
+};
+
+RenderJob job;
+PassOrder pass_order = PassOrder::SPIRAL;
+
+// Bumped whenever the view changes, a job tagged with an older one is superseded and stops at the next slice
+std::atomic<unsigned> view_generation = 0;
+ViewState generation_view;
+unsigned aborted_jobs = 0;
+double last_abort_ms = 0.0;
+double worst_abort_ms = 0.0;
+std::chrono::steady_clock::time_point input_time; // Last input that moved the view, aborts are timed from it
+
+GLFWwindow* main_window = nullptr;
+int progressive_mode = 2;
+float frame_budget_ms = 12.0f;
+
+bool supersample = true;
+bool aa_dirty = false;
+float aa_threshold = 0.1f;
+
+static ViewState currentView()
+{
+    ViewState v;
+    v.lx = lx;
+    v.ly = ly;
+    v.scroll = g_scroll;
+    v.iterations = iterations;
+    v.set = set;
+    v.d_prec = d_prec;
+    v.smooth_it = smooth_it;
+    v.dist_est = dist_est;
+    return v;
+}
+
+// Same fractal, possibly seen from a different place (coloring happens at display time)
+// Same function being iterated, only the limit may differ
+static bool sameFormula(const ViewState& a, const ViewState& b)
+{
+    return a.set == b.set && a.d_prec == b.d_prec && a.smooth_it == b.smooth_it && a.dist_est == b.dist_est;
+}
+
+static bool sameSettings(const ViewState& a, const ViewState& b)
+{
+    return a.iterations == b.iterations && sameFormula(a, b);
+}
+
+// Pixel shift that maps the image of view a onto view b, if they only differ by a whole pixel pan
+static bool panOffset(const ViewState& a, const ViewState& b, int* dx, int* dy)
+{
+    if(a.scroll != b.scroll || !sameSettings(a, b))
+        return false;
+
+    // One pixel of pan in lx/ly units (see the coordinate mapping in test.cs.glsl)
+    double sx = (b.lx - a.lx) / (2.0 * b.scroll * T_SIZE_W / T_SIZE_H);
+    double sy = (b.ly - a.ly) / (2.0 * b.scroll);
+    double rx = std::round(sx);
+    double ry = std::round(sy);
+
+    if(std::abs(sx - rx) > 1e-3 || std::abs(sy - ry) > 1e-3)
+        return false;
+
+    if(std::abs(rx) >= T_SIZE_W || std::abs(ry) >= T_SIZE_H)
+        return false;
+
+    // The texture y axis points up while ly grows downwards
+    *dx = (int)rx;
+    *dy = -(int)ry;
+    return true;
+}
+
+static void dispatchRect(InitData& idata, GLint x, GLint y, GLint w, GLint h, GLint stride = 1)
+{
+    if(w <= 0 || h <= 0)
+        return;
+
+    GLint sw = (w + stride - 1) / stride;
+    GLint sh = (h + stride - 1) / stride;
+
+    glUniform2i(idata.offsetl, x, y);
+    glUniform1i(idata.stridel, stride);
+    glDispatchCompute(sw, sh, 1);
+    last_dispatch_px += (unsigned long long)sw * sh;
+}
+
+static void swapRenderTargets(InitData& idata)
+{
+    std::swap(idata.iter_texture, idata.back_iter_texture);
+    glBindImageTexture(0, idata.iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+}
+
+// Shift the last image into the back texture and compute only the exposed strips
+static void dispatchPan(InitData& idata, int dx, int dy)
+{
+    GLint w = T_SIZE_W - std::abs(dx);
+    GLint h = T_SIZE_H - std::abs(dy);
+
+    glCopyImageSubData(
+        idata.iter_texture, GL_TEXTURE_2D, 0, std::max(-dx, 0), std::max(-dy, 0), 0,
+        idata.back_iter_texture, GL_TEXTURE_2D, 0, std::max(dx, 0), std::max(dy, 0), 0,
+        w, h, 1
+    );
+
+    glBindImageTexture(0, idata.back_iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+
+    // Exposed columns span the full height, exposed rows skip the columns already done
+    GLint col_x = dx > 0 ? 0 : T_SIZE_W + dx;
+    GLint row_x = dx > 0 ? dx : 0;
+    GLint row_y = dy > 0 ? 0 : T_SIZE_H + dy;
+    dispatchRect(idata, col_x, 0, std::abs(dx), T_SIZE_H);
+    dispatchRect(idata, row_x, row_y, w, std::abs(dy));
+
+    swapRenderTargets(idata);
+}
+
+// Affine map from the pixels of view b to the pixels of view a: src = coord * scale + shift
+static bool zoomMap(const ViewState& a, const ViewState& b, double scale[2], double shift[2])
+{
+    // A different limit is handled by the resample too
+    if(!sameFormula(a, b))
+        return false;
+
+    double s = b.scroll / a.scroll;
+
+    // Too far away for the old frame to be a useful preview
+    if(s < 1.0 / 16.0 || s > 16.0)
+        return false;
+
+    scale[0] = s;
+    scale[1] = s;
+    shift[0] = T_SIZE_W / 2.0 * (1.0 - s) + (a.lx - b.lx) / (2.0 * a.scroll * T_SIZE_W / T_SIZE_H);
+    shift[1] = T_SIZE_H / 2.0 * (1.0 - s) + (b.ly - a.ly) / (2.0 * a.scroll);
+    return true;
+}
+
+// Number of pixels along one axis that land exactly on a sample of the last frame
+static unsigned exactSamples(double scale, double shift, unsigned size)
+{
+    unsigned n = 0;
+    for(unsigned i = 0; i < size; i++)
+    {
+        double src = i * scale + shift;
+        double r = std::round(src);
+        if(std::abs(src - r) < 1e-3 && r >= 0.0 && r < size)
+            n++;
+    }
+    return n;
+}
+
+// Resample the last frame into the back texture as a preview, keeping the samples that line up exactly
+static void dispatchZoom(InitData& idata, const double scale[2], const double shift[2], unsigned old_iterations)
+{
+    glUseProgram(idata.resample_program);
+    glUniform2f(idata.resample_scalel, (float)scale[0], (float)scale[1]);
+    glUniform2f(idata.resample_shiftl, (float)shift[0], (float)shift[1]);
+    glUniform1f(idata.resample_old_itl, (float)old_iterations);
+    glUniform1f(idata.resample_new_itl, (float)iterations);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, idata.iter_texture);
+    glBindImageTexture(0, idata.back_iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glDispatchCompute((T_SIZE_W + 7) / 8, (T_SIZE_H + 7) / 8, 1);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(idata.compute_program);
+    swapRenderTargets(idata);
+
+    last_reused_px = (unsigned long long)exactSamples(scale[0], shift[0], T_SIZE_W) * exactSamples(scale[1], shift[1], T_SIZE_H);
+}
+
+static int tileIndex(double x, double y)
+{
+    int tiles_x = (T_SIZE_W + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (T_SIZE_H + TILE_SIZE - 1) / TILE_SIZE;
+    int tx = std::clamp((int)(x / TILE_SIZE), 0, tiles_x - 1);
+    int ty = std::clamp((int)(y / TILE_SIZE), 0, tiles_y - 1);
+    return ty * tiles_x + tx;
+}
+
+// Tiles in the order the passes visit them, cursor in texture pixels
+static std::vector<Tile> tileOrder(double cursor_x, double cursor_y)
+{
+    int tiles_x = (T_SIZE_W + TILE_SIZE - 1) / TILE_SIZE;
+    int tiles_y = (T_SIZE_H + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<Tile> tiles;
+
+    auto push = [&](int tx, int ty) {
+        if(tx < 0 || ty < 0 || tx >= tiles_x || ty >= tiles_y)
+            return;
+
+        Tile t;
+        t.x = tx * TILE_SIZE;
+        t.y = ty * TILE_SIZE;
+        t.w = std::min(TILE_SIZE, T_SIZE_W - t.x);
+        t.h = std::min(TILE_SIZE, T_SIZE_H - t.y);
+        tiles.push_back(t);
+    };
+
+    if(pass_order == PassOrder::SCANLINE)
+    {
+        // Top of the screen first (texture y points up)
+        for(int ty = tiles_y - 1; ty >= 0; ty--)
+            for(int tx = 0; tx < tiles_x; tx++)
+                push(tx, ty);
+    }
+    else if(pass_order == PassOrder::SPIRAL)
+    {
+        // Square spiral around the tile under the cursor, runs of 1, 1, 2, 2, 3, 3, ...
+        int tx = tileIndex(cursor_x, cursor_y) % tiles_x;
+        int ty = tileIndex(cursor_x, cursor_y) / tiles_x;
+        const int dirs[4][2] = { { 1, 0 }, { 0, -1 }, { -1, 0 }, { 0, 1 } };
+        int total = tiles_x * tiles_y;
+        int run = 1;
+        int d = 0;
+
+        push(tx, ty);
+        while((int)tiles.size() < total)
+        {
+            for(int k = 0; k < 2; k++, d = (d + 1) % 4)
+            {
+                for(int i = 0; i < run; i++)
+                {
+                    tx += dirs[d][0];
+                    ty += dirs[d][1];
+                    push(tx, ty);
+                }
+            }
+            run++;
+        }
+    }
+    else
+    {
+        // Closest tile centers first
+        double fx = pass_order == PassOrder::CENTER ? T_SIZE_W / 2.0 : cursor_x;
+        double fy = pass_order == PassOrder::CENTER ? T_SIZE_H / 2.0 : cursor_y;
+
+        for(int ty = 0; ty < tiles_y; ty++)
+            for(int tx = 0; tx < tiles_x; tx++)
+                push(tx, ty);
+
+        auto dist = [&](const Tile& t) {
+            double dx = t.x + t.w / 2.0 - fx;
+            double dy = t.y + t.h / 2.0 - fy;
+            return dx * dx + dy * dy;
+        };
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const Tile& a, const Tile& b) { return dist(a) < dist(b); });
+    }
+
+    return tiles;
+}
+
+// The cursor moved to another tile, put what is left of this pass in the new order
+static void reorderJob()
+{
+    std::vector<Tile> order = tileOrder(job.cursor_x, job.cursor_y);
+    std::vector<bool> visited(order.size(), false);
+
+    for(size_t i = 0; i < job.next; i++)
+        visited[tileIndex(job.tiles[i].x, job.tiles[i].y)] = true;
+
+    job.tiles.resize(job.next);
+    for(const Tile& t : order)
+    {
+        if(!visited[tileIndex(t.x, t.y)])
+            job.tiles.push_back(t);
+    }
+}
+
+static bool sameView(const ViewState& a, const ViewState& b)
+{
+    return a.lx == b.lx && a.ly == b.ly && a.scroll == b.scroll && sameSettings(a, b);
+}
+
+// New generation if anything the image depends on changed since the last call
+static unsigned syncGeneration()
+{
+    ViewState v = currentView();
+
+    if(!sameView(v, generation_view))
+    {
+        generation_view = v;
+        view_generation++;
+    }
+    return view_generation;
+}
+
+// Mouse drag panning, also polled between slices so a drag can supersede a running job
+static void handleDrag()
+{
+    static double rx = 0.0, ry = 0.0;
+    static double pan_x = 0.0, pan_y = 0.0;
+    static bool pressed = false;
+    double x, y;
+
+    glfwGetCursorPos(main_window, &x, &y);
+
+    if(glfwGetMouseButton(main_window, 0) == GLFW_PRESS)
+    {
+        if(!pressed)
+        {
+            rx = x;
+            ry = y;
+            pan_x = 0.0;
+            pan_y = 0.0;
+            pressed = true;
+        }
+        else
+        {
+            // Only move by whole pixels so the last frame can be shifted instead of recomputed
+            double step_x = 2.0 * g_scroll * T_SIZE_W / T_SIZE_H;
+            double step_y = 2.0 * g_scroll;
+            pan_x += (x - rx) * g_scroll;
+            pan_y += (y - ry) * g_scroll;
+
+            double nx = std::trunc(pan_x / step_x);
+            double ny = std::trunc(pan_y / step_y);
+            lx += nx * step_x;
+            ly += ny * step_y;
+            if(nx != 0.0 || ny != 0.0)
+                input_time = std::chrono::steady_clock::now();
+            pan_x -= nx * step_x;
+            pan_y -= ny * step_y;
+
+            rx = x;
+            ry = y;
+        }
+    }
+    else if(glfwGetMouseButton(main_window, 0) == GLFW_RELEASE && pressed)
+    {
+        pressed = false;
+    }
+}
+
+// Input is only taken here, at the top of the main loop and between slices of a job, never mid-dispatch
+static void pollInput()
+{
+    glfwPollEvents();
+    if(!single_mode)
+        handleDrag();
+}
+
+// Start refining the whole frame again, exact pixels (>= 0) are skipped by the passes
+static void restartJob()
+{
+    static const int strides[][3] = { { 1 }, { 2, 1 }, { 4, 2, 1 } };
+    static const int count[] = { 1, 2, 3 };
+
+    job.strides.assign(strides[progressive_mode], strides[progressive_mode] + count[progressive_mode]);
+    job.tiles = tileOrder(job.cursor_x, job.cursor_y);
+    job.pass = 0;
+    job.next = 0;
+    job.done = false;
+    job.generation = syncGeneration();
+    job.start = std::chrono::steady_clock::now();
+    job.cursor_ms = -1.0;
+    job.adapted = false;
+}
+
+// Work through the job until the frame budget runs out, syncing with the GPU every ~1ms worth of pixels
+static void runJob(InitData& idata, double budget_ms)
+{
+    using namespace std::chrono;
+
+    static double ns_per_px = 16.0; // Small first slice until one gets timed
+    auto start = steady_clock::now();
+    auto slice_start = start;
+    unsigned long long slice_px = (unsigned long long)(1E6 / ns_per_px);
+    unsigned long long done_px = 0;
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glUniform1i(idata.pending_onlyl, 1);
+
+    while(!job.done)
+    {
+        const Tile& t = job.tiles[job.next];
+        int stride = job.strides[job.pass];
+        unsigned long long before = last_dispatch_px;
+
+        dispatchRect(idata, t.x, t.y, t.w, t.h, stride);
+        done_px += last_dispatch_px - before;
+
+        // Last pass over the tile the user is looking at, wait for it to land to time it
+        if(job.pass + 1 == job.strides.size() && job.cursor_ms < 0.0 && tileIndex(t.x, t.y) == job.cursor_tile)
+        {
+            glFinish();
+            job.cursor_ms = duration<double, std::milli>(steady_clock::now() - job.start).count();
+        }
+
+        if(++job.next == job.tiles.size())
+        {
+            job.next = 0;
+            if(++job.pass == job.strides.size())
+            {
+                job.done = true;
+                job.time_ms = duration<double, std::milli>(steady_clock::now() - job.start).count();
+            }
+            else
+            {
+                job.tiles = tileOrder(job.cursor_x, job.cursor_y);
+            }
+        }
+
+        if(done_px >= slice_px && !job.done)
+        {
+            // Pick up input that arrived during the slice while the GPU still works on it, it may
+            // supersede this job
+            pollInput();
+
+            glFinish();
+            auto now = steady_clock::now();
+            ns_per_px = std::max(duration<double, std::nano>(now - slice_start).count() / done_px, 1e-3);
+            slice_px = std::max((unsigned long long)(1E6 / ns_per_px), 4096ull);
+            done_px = 0;
+
+            if(syncGeneration() != job.generation)
+            {
+                // From the input to the GPU being free for the new view
+                last_abort_ms = duration<double, std::milli>(now - input_time).count();
+                worst_abort_ms = std::max(worst_abort_ms, last_abort_ms);
+                aborted_jobs++;
+                break;
+            }
+
+            slice_start = now;
+
+            if(duration<double, std::milli>(now - start).count() >= budget_ms)
+                break;
+        }
+    }
+
+    glUniform1i(idata.pending_onlyl, 0);
+}
+
+// Each round refines the pixels still above the threshold by AA_BATCH samples, captures run them all at once
+static void runSupersample(InitData& idata, int rounds)
+{
+    if(!supersample)
+        return;
+
+    glUniform1f(idata.aa_thresholdl, aa_threshold);
+
+    for(int i = 0; i < rounds && job.aa_round < AA_SAMPLES / AA_BATCH; i++)
+    {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glUniform1i(idata.aa_roundl, ++job.aa_round);
+        dispatchRect(idata, 0, 0, T_SIZE_W, T_SIZE_H);
+    }
+
+    glUniform1i(idata.aa_roundl, 0);
+}
+
+// Render the current view, reusing the last frame if it can be
+static void dispatchView(InitData& idata, bool force, double cursor_x, double cursor_y)
+{
+    ViewState v = currentView();
+    double scale[2], shift[2];
+    int dx, dy;
+
+    last_dispatch_px = 0;
+
+    // Supersamples only belong to the view they were taken for
+    if(!sameView(v, last_view) || aa_dirty)
+    {
+        static const GLuint zero = 0;
+        glClearTexImage(idata.aa_count_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        job.aa_round = 0;
+        aa_dirty = false;
+    }
+
+    // Still the same view the job was started for, it keeps going under the current generation
+    if(sameView(v, last_view))
+        job.generation = syncGeneration();
+
+    // Window y points down, texture y points up
+    job.cursor_x = cursor_x;
+    job.cursor_y = T_SIZE_H - 1 - cursor_y;
+    int cursor_tile = tileIndex(job.cursor_x, job.cursor_y);
+    bool cursor_moved = cursor_tile != job.cursor_tile;
+    job.cursor_tile = cursor_tile;
+
+    if(force)
+    {
+        // Captures need the whole frame right now. Zooming by a whole factor (mult_frame of 2, 3, 4...) keeps
+        // samples of the last frame on the new grid, those are resampled and only the rest is iterated
+        if(!dist_est && last_view_valid && zoomMap(last_view, v, scale, shift) &&
+            exactSamples(scale[0], shift[0], T_SIZE_W) > 0 && exactSamples(scale[1], shift[1], T_SIZE_H) > 0)
+        {
+            dispatchZoom(idata, scale, shift, last_view.iterations);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            glUniform1i(idata.pending_onlyl, 1);
+            dispatchRect(idata, 0, 0, T_SIZE_W, T_SIZE_H);
+            glUniform1i(idata.pending_onlyl, 0);
+        }
+        else
+        {
+            dispatchRect(idata, 0, 0, T_SIZE_W, T_SIZE_H);
+            last_reused_px = 0;
+        }
+        job.done = true;
+        job.adapted = false;
+    }
+    // The distance estimates are not moved along with the iteration buffer, so they can't be reused
+    else if(last_view_valid && panOffset(last_view, v, &dx, &dy) && (!dist_est || (dx == 0 && dy == 0)))
+    {
+        if(dx != 0 || dy != 0)
+        {
+            dispatchPan(idata, dx, dy);
+
+            // Unfinished pixels moved around, let the passes find them again
+            if(!job.done)
+                restartJob();
+        }
+        else if(!job.done && cursor_moved && pass_order != PassOrder::SCANLINE && pass_order != PassOrder::CENTER)
+        {
+            reorderJob();
+        }
+    }
+    else if(!dist_est && last_view_valid && zoomMap(last_view, v, scale, shift))
+    {
+        dispatchZoom(idata, scale, shift, last_view.iterations);
+        restartJob();
+    }
+    else
+    {
+        // Pending with no estimate, shows as black until the first pass gets there
+        static const float cleared = -1E30f;
+        glClearTexImage(idata.iter_texture, 0, GL_RED, GL_FLOAT, &cleared);
+        restartJob();
+    }
+
+    if(!job.done)
+        runJob(idata, frame_budget_ms);
+    else
+        runSupersample(idata, force ? AA_SAMPLES / AA_BATCH : 1);
+
+    last_view = v;
+    last_view_valid = true;
+    buffer_iterations = iterations;
+}
+
+bool temporal_aa = true;
+unsigned accum_frames = 0;
+int accum_row = 0;
+ViewState accum_view;
+
+// While the view sits still every idle frame adds one jittered sample per pixel to accum_texture. The
+// jittered frame goes into the back texture a band of tiles at a time, so deep views keep the UI responsive
+static void runAccumulation(InitData& idata, double budget_ms)
+{
+    using namespace std::chrono;
+
+    ViewState v = currentView();
+    if(accum_dirty || !sameView(v, accum_view))
+    {
+        accum_frames = 0;
+        accum_row = 0;
+        accum_view = v;
+        accum_dirty = false;
+    }
+
+    // Starts from the finished, supersampled view
+    if(!temporal_aa || !job.done || (supersample && job.aa_round < AA_SAMPLES / AA_BATCH) || accum_frames >= ACCUM_FRAMES)
+        return;
+
+    if(accum_frames == 0)
+    {
+        drawColor(idata, idata.accum_fb, idata.iter_texture, 0);
+        glUseProgram(idata.compute_program);
+        accum_frames = 1;
+    }
+
+    // R2 sequence, the first frame is the unjittered one
+    float jx = (float)std::fmod(0.5 + accum_frames * 0.7548776662, 1.0) - 0.5f;
+    float jy = (float)std::fmod(0.5 + accum_frames * 0.5698402910, 1.0) - 0.5f;
+
+    glUniform2f(idata.jitterl, jx, jy);
+    glUniform1i(idata.pending_onlyl, 0);
+    glBindImageTexture(0, idata.back_iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+
+    // The Dispatched statistic counts what the view needed, not the jittered passes on top of it
+    unsigned long long dispatched = last_dispatch_px;
+
+    auto start = steady_clock::now();
+    while(accum_row < T_SIZE_H)
+    {
+        dispatchRect(idata, 0, accum_row, T_SIZE_W, std::min(TILE_SIZE, T_SIZE_H - accum_row));
+        accum_row += TILE_SIZE;
+
+        glFinish();
+        if(duration<double, std::milli>(steady_clock::now() - start).count() > budget_ms)
+            break;
+    }
+
+    last_dispatch_px = dispatched;
+
+    glUniform2f(idata.jitterl, 0.0f, 0.0f);
+    glBindImageTexture(0, idata.iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+
+    if(accum_row < T_SIZE_H)
+        return;
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    drawColor(idata, idata.accum_fb, idata.back_iter_texture, 1);
+    glDisable(GL_BLEND);
+    glUseProgram(idata.compute_program);
+
+    accum_frames++;
+    accum_row = 0;
+}
+
+bool benchmark_todo = false;
+double bench_int_ms = 0.0, bench_smooth_ms = 0.0, bench_de_ms = 0.0;
+
+// Best of a few full view renders into the back texture, timed on the GPU
+static double timeKernel(InitData& idata, bool smooth, bool de)
+{
+    GLuint query;
+    glGenQueries(1, &query);
+    glUniform1i(idata.smooth_itl, (int)smooth);
+    glUniform1i(idata.dist_estl, (int)de);
+
+    double best = 1E30;
+    for(int i = 0; i < 3; i++)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        dispatchRect(idata, 0, 0, T_SIZE_W, T_SIZE_H);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        best = std::min(best, ns / 1E6);
+    }
+
+    glDeleteQueries(1, &query);
+    return best;
+}
+
+static void benchmarkKernel(InitData& idata)
+{
+    // Overwrites a half done jittered frame
+    accum_dirty = true;
+
+    glBindImageTexture(0, idata.back_iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glUniform1i(idata.pending_onlyl, 0);
+
+    bench_int_ms = timeKernel(idata, false, false);
+    bench_smooth_ms = timeKernel(idata, true, false);
+    bench_de_ms = timeKernel(idata, true, true);
+
+    glUniform1i(idata.smooth_itl, (int)smooth_it);
+    glUniform1i(idata.dist_estl, (int)dist_est);
+    glBindImageTexture(0, idata.iter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+}
+
+struct FrameStats
+{
+    GLuint interior;
+    GLuint escaped;
+    GLuint near_max;
+    GLuint max_escape;
+};
+
+bool adaptive_it = false;
+FrameStats last_stats = {};
+
+// Called once a view is final. Lowering to twice the highest escape count changes no pixel, raising only
+// happens while a noticeable share of the pixels escapes in the top quarter of the range, where detail is
+// about to turn black
+static void adaptIterations(InitData& idata)
+{
+    static const double near_max_fraction = 0.001;
+    static const unsigned min_iterations = 64;
+    static const unsigned max_iterations = 1000000;
+
+    buildHistogram(idata);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, idata.stats_ssbo);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(FrameStats), &last_stats);
+    glUseProgram(idata.compute_program);
+
+    if(last_stats.escaped == 0)
+        return;
+
+    if(last_stats.near_max > near_max_fraction * ((double)last_stats.escaped + last_stats.interior))
+    {
+        iterations = std::min(buffer_iterations * 2, max_iterations);
+    }
+    else if(last_stats.max_escape < buffer_iterations / 4)
+    {
+        iterations = std::max(last_stats.max_escape * 2, min_iterations);
+    }
+}
+
+// The view the globals describe, on the compute program
+static void setViewUniforms(InitData& idata)
+{
+    glUniform1d(idata.pxld, lx / T_SIZE_W);
+    glUniform1d(idata.pyld, ly / T_SIZE_H);
+    glUniform1f(idata.pxl, (float)lx / T_SIZE_W);
+    glUniform1f(idata.pyl, (float)ly / T_SIZE_H);
+    glUniform1d(idata.zoomld, g_scroll);
+    glUniform1f(idata.zooml, (float)g_scroll);
+    glUniform1ui(idata.max_itl, iterations);
+    glUniform1ui(idata.setl, set);
+    glUniform1i(idata.smooth_itl, (int)smooth_it);
+    glUniform1i(idata.dist_estl, (int)dist_est);
+}
+
+long long runSingleFrameTimed(double mag, InitData& idata)
+{
+    // Time
+    tp = std::chrono::high_resolution_clock::now();
+    auto dur = tp - ltp;
+    ltp = tp;
+
+    // Setup
+    g_scroll = 1.0 / mag;
+
+    // Dispatch
+    dispatch_todo = true;
+
+    // Save last frame, the one dispatched on the previous call
+    if(dispatchDone && capture_dispatched)
+    {
+        saveFBOImage(idata);
+    }
+    capture_dispatched = true;
+    return dur.count();
+}
+
+// Zoom captures can iterate one keyframe per octave of magnification instead of every frame. A keyframe is
+// rendered at twice the resolution as four quadrant views, so the frames resampled from it until the next
+// octave never magnify it
+bool keyframe_zoom = false;
+int keyframe_index = -1;
+unsigned keyframes_rendered = 0;
+
+static void renderKeyframe(InitData& idata, double mag)
+{
+    double base_lx = lx, base_ly = ly;
+    bool base_supersample = supersample;
+
+    // Supersamples belong to the quadrant views, they wouldn't survive the resample
+    supersample = false;
+    glUseProgram(idata.compute_program);
+
+    for(int q = 0; q < 4; q++)
+    {
+        int qx = q & 1, qy = q >> 1;
+
+        // Each quadrant has half the extent of the keyframe view (see the coordinate mapping in test.cs.glsl)
+        g_scroll = 0.5 / mag;
+        lx = base_lx + (0.5 - qx) * (1.0 / mag) * T_SIZE_W * T_SIZE_W / T_SIZE_H;
+        ly = base_ly + (qy - 0.5) * (1.0 / mag) * T_SIZE_H;
+
+        setViewUniforms(idata);
+        dispatchView(idata, true, 0.0, 0.0);
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+        glCopyImageSubData(idata.iter_texture, GL_TEXTURE_2D, 0, 0, 0, 0, idata.key_texture, GL_TEXTURE_2D, 0, qx * T_SIZE_W, qy * T_SIZE_H, 0, T_SIZE_W, T_SIZE_H, 1);
+        if(dist_est)
+            glCopyImageSubData(idata.de_texture, GL_TEXTURE_2D, 0, 0, 0, 0, idata.key_de_texture, GL_TEXTURE_2D, 0, qx * T_SIZE_W, qy * T_SIZE_H, 0, T_SIZE_W, T_SIZE_H, 1);
+    }
+
+    lx = base_lx;
+    ly = base_ly;
+    supersample = base_supersample;
+    keyframes_rendered++;
+}
+
+long long runKeyframeFrameTimed(double mag, InitData& idata)
+{
+    // Time
+    tp = std::chrono::steady_clock::now();
+    auto dur = tp - ltp;
+    ltp = tp;
+
+    int k = (int)std::floor(std::log2(mag / min_mag) + 1e-9);
+    double key_mag = min_mag * std::exp2(k);
+
+    if(k != keyframe_index)
+    {
+        renderKeyframe(idata, key_mag);
+        keyframe_index = k;
+    }
+
+    g_scroll = 1.0 / mag;
+
+    glUseProgram(idata.keyframe_program);
+    glUniform1f(idata.keyframe_scalel, (float)(key_mag / mag));
+    glUniform1i(idata.keyframe_dist_estl, (int)dist_est);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, idata.key_texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, idata.key_de_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glDispatchCompute((T_SIZE_W + 7) / 8, (T_SIZE_H + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glUseProgram(idata.compute_program);
+
+    // The buffer no longer matches the last dispatched view, nothing can be reused from it
+    last_view_valid = false;
+
+    saveFBOImage(idata);
+    return dur.count();
+}
+
+// CPU backend for zoom captures. Whole frames are iterated at once by worker threads, each frame on its
+// share of the threads, and queued in a reorder buffer. The GPU then colors and writes them in sequence
+// through the usual readback path. A view that supersamples gets a second pass over its finished frame with
+// the refinement rounds of the compute shader. Frames in flight, queued ones included, share a fixed pool
+// of buffers
+#define CPU_MAX_IN_FLIGHT 16
+
+// Defaults of the uniforms of the same name in test.cs.glsl, the UI only sets the threshold
+#define CPU_AA_DE_SKIP 4.0f
+#define CPU_AA_TOLERANCE 0.02f
+
+// What one frame is iterated from, a capture steps the magnification of a single view
+struct CpuView
+{
+    double lx, ly;
+    double mag;
+    unsigned iterations;
+    unsigned set;
+    bool smooth_it;
+    bool dist_est;
+    bool supersample;
+    std::string path = ""; // Next numbered frame of the capture when empty
+    double ms = 0.0;       // From the first row started to the last one done
+    Poster* poster = nullptr;
+    int tile = 0;
+};
+
+struct CpuFrame
+{
+    unsigned index = 0;
+    CpuView* view = nullptr;
+    std::chrono::steady_clock::time_point start;
+    std::vector<float> iter;
+    std::vector<float> de;
+    std::vector<float> aa_samples; // AA_SAMPLES layers of W*H, as the array texture
+    std::vector<GLuint> aa_count;
+    std::atomic<unsigned> aa_layers = 0; // Most layers any pixel filled
+    std::atomic<int> next_row = 0;
+    int workers = 0;
+    int phase = 0; // Iterating, then supersampling the finished rows
+};
+
+struct CpuRender
+{
+    std::vector<CpuView> views;
+    int share = 1;
+    float aa_threshold = 0.1f;
+
+    CpuFrame frames[CPU_MAX_IN_FLIGHT];
+    std::vector<CpuFrame*> free;
+    std::vector<CpuFrame*> active;
+    std::map<unsigned, CpuFrame*> done; // Reorder buffer, keyed by frame index
+    unsigned next_frame = 0;            // Next one a worker starts
+    unsigned next_out = 0;              // Next one colored and written
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::atomic<bool> quit = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+CpuRender cpu;
+bool cpu_capture = false;
+int cpu_in_flight = 4;
+
+static float cpuSmoothCount(const CpuView& v, unsigned i, unsigned maxit, float r2, float degree)
+{
+    if(i >= maxit)
+        return (float)maxit;
+
+    if(!v.smooth_it)
+        return (float)i;
+
+    float nu = std::log2(std::log2(r2) / std::log2(65536.0f)) / std::log2(degree);
+    return std::min((float)i + std::clamp(1.0f - nu, 0.0f, 0.9999f), (float)maxit - 0.5f);
+}
+
+// Same as the double kernels of test.cs.glsl
+static float cpuSample(const CpuView& v, double x, double y, float* de)
+{
+    const unsigned maxit = v.iterations;
+    const bool track = v.dist_est;
+    const double bail = v.smooth_it || v.dist_est ? 65536.0 : 4.0;
+    double zr = 0, zi = 0, zrsqr = 0, zisqr = 0, dzr = 0, dzi = 0;
+    float degree = 2.0f;
+    unsigned i;
+
+    if(v.set == 1)
+        y = -y;
+
+    for(i = 0; i < maxit; i++)
+    {
+        if(v.set == 2)
+        {
+            degree = 3.0f;
+            if(track)
+            {
+                double sr = zrsqr - zisqr, si = 2 * zr * zi;
+                double t = 3 * (sr * dzr - si * dzi) + 1;
+                dzi = 3 * (sr * dzi + si * dzr);
+                dzr = t;
+            }
+
+            double nzi = 3 * zrsqr * zi - zisqr * zi + y;
+            zr = zrsqr * zr - 3 * zr * zisqr + x;
+            zi = nzi;
+        }
+        else
+        {
+            if(track)
+            {
+                double fr = dzr, fi = dzi, ar = zr, ai = zi;
+
+                // The abs folds of the ship are reflections, applied to dz as well
+                if(v.set == 1)
+                {
+                    fr = ((zr > 0) - (zr < 0)) * dzr;
+                    fi = ((zi > 0) - (zi < 0)) * dzi;
+                    ar = std::abs(zr);
+                    ai = std::abs(zi);
+                }
+
+                double t = 2 * (ar * fr - ai * fi) + 1;
+                dzi = 2 * (ar * fi + ai * fr);
+                dzr = t;
+            }
+
+            zi = zr * zi;
+            zi += zi;
+            if(v.set == 1)
+                zi = std::abs(zi);
+            zi += y;
+
+            zr = zrsqr - zisqr + x;
+        }
+
+        zrsqr = zr * zr;
+        zisqr = zi * zi;
+
+        if(zrsqr + zisqr > bail) break;
+    }
+
+    float r2 = (float)(zrsqr + zisqr);
+    float dz2 = (float)(dzr * dzr + dzi * dzi);
+    *de = (i >= maxit || dz2 <= 0.0f) ? 0.0f : 0.25f * std::sqrt(r2 / dz2) * std::log(r2);
+
+    return cpuSmoothCount(v, i, maxit, r2, degree);
+}
+
+// Coordinate mapping of sampleAt, de comes out in pixels
+static float cpuSampleAt(const CpuView& v, double px, double py, float* de)
+{
+    const double zoom = 1.0 / v.mag;
+    double cx = (px / T_SIZE_W - 0.5) * 2 * zoom * (16.0 / 9.0) - v.lx / T_SIZE_W;
+    double cy = (py / T_SIZE_H - 0.5) * 2 * zoom + v.ly / T_SIZE_H;
+
+    float it = cpuSample(v, cx, cy, de);
+    *de = (float)(*de * T_SIZE_H / (2.0 * zoom));
+    return it;
+}
+
+static void cpuRow(CpuFrame* f, int y)
+{
+    const CpuView& v = *f->view;
+    float* iter = f->iter.data() + (size_t)y * T_SIZE_W;
+
+    for(int x = 0; x < T_SIZE_W; x++)
+    {
+        float de;
+        iter[x] = cpuSampleAt(v, x, y, &de);
+
+        if(v.dist_est)
+            f->de[(size_t)y * T_SIZE_W + x] = de;
+    }
+}
+
+// All rounds of supersample in test.cs.glsl for a row at once. A pixel only depends on the finished frame
+// and its own samples, so this ends where the rounds on the GPU do
+static void cpuSupersampleRow(CpuFrame* f, int y)
+{
+    const CpuView& v = *f->view;
+    const size_t layer = (size_t)T_SIZE_W * T_SIZE_H;
+    const float* iter = f->iter.data();
+    auto level = [&](float it) { return std::log2(1.0f + std::min(it, (float)v.iterations)); };
+    unsigned layers = 0;
+
+    for(int x = 0; x < T_SIZE_W; x++)
+    {
+        size_t p = (size_t)y * T_SIZE_W + x;
+        float l = level(iter[p]);
+        f->aa_count[p] = 0;
+
+        if(v.dist_est && f->de[p] > CPU_AA_DE_SKIP)
+            continue;
+
+        float c = 0.0f;
+        const int nx[4] = { x - 1, x + 1, x, x }, ny[4] = { y, y, y - 1, y + 1 };
+        for(int i = 0; i < 4; i++)
+        {
+            size_t q = (size_t)std::clamp(ny[i], 0, T_SIZE_H - 1) * T_SIZE_W + std::clamp(nx[i], 0, T_SIZE_W - 1);
+            c = std::max(c, std::abs(level(iter[q]) - l));
+        }
+
+        if(c < cpu.aa_threshold)
+            continue;
+
+        // Same rotation and offsets, the samples land in the same layers
+        uint32_t h = (uint32_t)x * 1973u + (uint32_t)y * 9277u;
+        h = (h ^ (h >> 13)) * 0x5bd1e995u;
+        float rx = (h & 0xffffu) / 65536.0f, ry = (h >> 16) / 65536.0f;
+        float sum = l, sum2 = l * l;
+        unsigned n = 0;
+
+        while(n < AA_SAMPLES)
+        {
+            for(unsigned i = n; i < n + AA_BATCH; i++)
+            {
+                float jx = rx + (float)(i + 1) * 0.7548776662f, jy = ry + (float)(i + 1) * 0.5698402910f;
+                float de;
+                float s = cpuSampleAt(v, x + (jx - std::floor(jx)) - 0.5, y + (jy - std::floor(jy)) - 0.5, &de);
+                f->aa_samples[layer * i + p] = s;
+                s = level(s);
+                sum += s;
+                sum2 += s * s;
+            }
+            n += AA_BATCH;
+
+            float k = (float)(n + 1);
+            float var = std::max(sum2 / k - (sum / k) * (sum / k), 0.0f);
+            if(std::sqrt(var / k) < CPU_AA_TOLERANCE)
+                break;
+        }
+
+        f->aa_count[p] = n;
+        layers = std::max(layers, n);
+    }
+
+    unsigned m = f->aa_layers;
+    while(m < layers && !f->aa_layers.compare_exchange_weak(m, layers));
+}
+
+static void cpuWorker()
+{
+    std::unique_lock<std::mutex> l(cpu.lock);
+
+    while(!cpu.quit)
+    {
+        // Help a frame short of its share, else start the next one, else help anywhere rows are left. Active
+        // frames are in the order they started, the oldest comes first since next_out waits on it
+        CpuFrame* f = nullptr;
+        for(CpuFrame* a : cpu.active)
+            if(a->workers < cpu.share && a->next_row < T_SIZE_H)
+            {
+                f = a;
+                break;
+            }
+
+        if(!f && cpu.next_frame < cpu.views.size() && !cpu.free.empty())
+        {
+            f = cpu.free.back();
+            cpu.free.pop_back();
+            f->index = cpu.next_frame;
+            f->view = &cpu.views[cpu.next_frame++];
+            f->start = std::chrono::steady_clock::now();
+            f->next_row = 0;
+            f->phase = 0;
+            f->aa_layers = 0;
+            cpu.active.push_back(f);
+        }
+
+        if(!f)
+            for(CpuFrame* a : cpu.active)
+                if(a->next_row < T_SIZE_H)
+                {
+                    f = a;
+                    break;
+                }
+
+        if(!f)
+        {
+            if(cpu.next_frame == cpu.views.size() && cpu.active.empty())
+                return;
+
+            cpu.cv.wait(l);
+            continue;
+        }
+
+        f->workers++;
+        l.unlock();
+
+        for(int y; !cpu.quit && (y = f->next_row++) < T_SIZE_H;)
+            f->phase == 0 ? cpuRow(f, y) : cpuSupersampleRow(f, y);
+
+        l.lock();
+
+        // The last worker out of a finished frame queues it. Contrast looks at the rows around a pixel, so
+        // supersampling goes over the frame again once all of them are done
+        if(--f->workers == 0 && f->next_row >= T_SIZE_H && f->phase == 0 && f->view->supersample)
+        {
+            f->phase = 1;
+            f->next_row = 0;
+        }
+        else if(f->workers == 0 && f->next_row >= T_SIZE_H)
+        {
+            f->view->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - f->start).count();
+            cpu.active.erase(std::find(cpu.active.begin(), cpu.active.end(), f));
+            cpu.done[f->index] = f;
+        }
+        cpu.cv.notify_all();
+    }
+}
+
+static void stopCpuCapture()
+{
+    cpu.quit = true;
+    {
+        std::lock_guard<std::mutex> l(cpu.lock);
+        cpu.cv.notify_all();
+    }
+
+    for(std::thread& t : cpu.threads)
+        t.join();
+    cpu.threads.clear();
+}
+
+// Iterates the views from index first on, in_flight of them at once
+static void startCpuRender(std::vector<CpuView> views, int first, int in_flight)
+{
+    stopCpuCapture();
+
+    cpu.views = std::move(views);
+    bool any_de = std::any_of(cpu.views.begin(), cpu.views.end(), [](const CpuView& v) { return v.dist_est; });
+    bool any_aa = std::any_of(cpu.views.begin(), cpu.views.end(), [](const CpuView& v) { return v.supersample; });
+    cpu.aa_threshold = aa_threshold;
+
+    in_flight = std::clamp(in_flight, 1, CPU_MAX_IN_FLIGHT);
+    int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    cpu.share = std::max(threads / in_flight, 1);
+
+    cpu.free.clear();
+    cpu.active.clear();
+    cpu.done.clear();
+    for(int i = 0; i < in_flight; i++)
+    {
+        CpuFrame& f = cpu.frames[i];
+        f.iter.resize((size_t)T_SIZE_W * T_SIZE_H);
+        f.de.resize(any_de ? (size_t)T_SIZE_W * T_SIZE_H : 0);
+        f.aa_samples.resize(any_aa ? (size_t)T_SIZE_W * T_SIZE_H * AA_SAMPLES : 0);
+        f.aa_count.resize(any_aa ? (size_t)T_SIZE_W * T_SIZE_H : 0);
+        f.workers = 0;
+        cpu.free.push_back(&f);
+    }
+
+    cpu.next_frame = first;
+    cpu.next_out = first;
+    cpu.quit = false;
+    cpu.start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < threads; i++)
+        cpu.threads.emplace_back(cpuWorker);
+}
+
+static void startCpuCapture(int first)
+{
+    // The same magnifications the GPU capture steps through, all from a snapshot of the view
+    std::vector<CpuView> views;
+    for(double mag = min_mag; mag <= max_mag; mag *= mult_frame)
+        views.push_back({lx, ly, mag, iterations, set, smooth_it, dist_est, supersample});
+
+    startCpuRender(std::move(views), first, cpu_in_flight);
+}
+
+// Colors and writes the finished frames that are next in sequence, returns how many. prepare gets the
+// index of every frame right before it is colored
+static unsigned runCpuFrames(InitData& idata, void (*prepare)(unsigned index) = nullptr)
+{
+    unsigned n = 0;
+
+    while(true)
+    {
+        CpuFrame* f;
+        {
+            std::lock_guard<std::mutex> l(cpu.lock);
+            auto it = cpu.done.find(cpu.next_out);
+            if(it == cpu.done.end())
+                break;
+            f = it->second;
+            cpu.done.erase(it);
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, idata.iter_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, T_SIZE_W, T_SIZE_H, GL_RED, GL_FLOAT, f->iter.data());
+        if(f->view->dist_est)
+        {
+            glBindTexture(GL_TEXTURE_2D, idata.de_texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, T_SIZE_W, T_SIZE_H, GL_RED, GL_FLOAT, f->de.data());
+        }
+
+        // Supersamples of whatever the GPU rendered last don't belong to this frame, it brings its own or none
+        if(f->view->supersample)
+        {
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_2D, idata.aa_count_texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, T_SIZE_W, T_SIZE_H, GL_RED_INTEGER, GL_UNSIGNED_INT, f->aa_count.data());
+            if(f->aa_layers > 0)
+            {
+                glActiveTexture(GL_TEXTURE4);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, idata.aa_texture);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, T_SIZE_W, T_SIZE_H, f->aa_layers, GL_RED, GL_FLOAT,
+                                f->aa_samples.data());
+            }
+            glActiveTexture(GL_TEXTURE0);
+        }
+        else
+        {
+            static const GLuint zero = 0;
+            glClearTexImage(idata.aa_count_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        }
+        last_view_valid = false;
+
+        // Coloring goes by the limit of the buffer and the EXR planes by dist_est, the view the UI shows
+        // keeps its own settings
+        const CpuView& v = *f->view;
+        bool base_dist_est = dist_est;
+        buffer_iterations = v.iterations;
+        dist_est = v.dist_est;
+        if(prepare)
+            prepare(f->index);
+
+        saveFBOImage(idata, v.path, v.poster, v.tile);
+        dist_est = base_dist_est;
+
+        {
+            std::lock_guard<std::mutex> l(cpu.lock);
+            cpu.free.push_back(f);
+            cpu.next_out++;
+            cpu.cv.notify_all();
+        }
+        n++;
+    }
+
+    return n;
+}
+
+// Journal of a capture in progress, <epoch>.journal next to its output. The header holds everything the
+// frames depend on, the writer adds a line for every frame on disk and a finished capture ends with "done".
+// Doubles are stored as hex floats, a resumed capture steps through the exact same magnifications
+static std::filesystem::path journalPath(int epoch)
+{
+    return std::filesystem::current_path() / (std::to_string(epoch) + ".journal");
+}
+
+static void setJournal(FILE* j)
+{
+    std::lock_guard<std::mutex> l(writer.lock);
+    writer.journal = j;
+}
+
+static void openJournal(bool append)
+{
+    // Nothing to resume into
+    if(capture_format == 2)
+        return;
+
+    FILE* j = fopen(journalPath(epoch_min).string().c_str(), append ? "a" : "w");
+    if(!j)
+    {
+        std::cerr << "Could not open the capture journal" << std::endl;
+        return;
+    }
+
+    if(!append)
+    {
+        fprintf(j, "capture 1\n");
+        fprintf(j, "view %a %a %u %u %d %d\n", lx, ly, iterations, set, (int)smooth_it, (int)dist_est);
+        fprintf(j, "zoom %a %a %a\n", min_mag, max_mag, (double)mult_frame);
+        fprintf(j, "color %d %d %a %a %a %a\n", color_mode, color_scale, (double)color_period,
+            (double)single_color[0], (double)single_color[1], (double)single_color[2]);
+        fprintf(j, "stops %zu", custom_stops.size());
+        for(const PaletteStop& s : custom_stops)
+            fprintf(j, " %a %a %a %a", (double)s.pos, (double)s.color[0], (double)s.color[1], (double)s.color[2]);
+        fprintf(j, "\n");
+        fprintf(j, "output %d %d %d %d\n", capture_format, image_format, (int)exr_half, capture_fps);
+        fprintf(j, "mode %d %d %d\n", (int)keyframe_zoom, (int)cpu_capture, cpu_in_flight);
+        fprintf(j, "aa %d %a\n", (int)supersample, (double)aa_threshold);
+        fprintf(j, "adaptive %d\n", (int)adaptive_it);
+        fflush(j);
+    }
+
+    if(!readback.worker.joinable())
+        initReadback();
+    setJournal(j);
+}
+
+// After finishReadback, every frame is journaled by then
+static void closeJournal()
+{
+    FILE* j = nullptr;
+    {
+        std::lock_guard<std::mutex> l(writer.lock);
+        std::swap(j, writer.journal);
+    }
+
+    if(!j)
+        return;
+
+    fprintf(j, "done\n");
+    fclose(j);
+}
+
+// Wall clock minutes name a new capture. Steady clock time restarts with the machine, and a second capture
+// in the same minute would take over the journal and frames of the first, so a taken id moves on
+static int newCaptureEpoch()
+{
+    auto dir = std::filesystem::current_path();
+    int epoch = (int)std::chrono::duration_cast<std::chrono::minutes>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+
+    std::error_code ec;
+    while(std::filesystem::exists(journalPath(epoch), ec) || std::filesystem::exists(dir / std::to_string(epoch), ec) ||
+          std::filesystem::exists(dir / (std::to_string(epoch) + ".y4m"), ec))
+        epoch++;
+
+    return epoch;
+}
+
+// Frames before first are already on disk
+static void startCapture(int first)
+{
+    number_frames = log(max_mag / min_mag) / log(mult_frame);
+    std::cout << "Frames to generate: " << number_frames << std::endl;
+    std::cout << "Duration: " << number_frames / 30.0 << "s at 30 fps" << std::endl;
+    std::cout << "Duration: " << number_frames / 60.0 << "s at 60 fps" << std::endl;
+
+    single_mode = true;
+    d_prec = true;
+
+    // Stepped the same way the capture does
+    curr_mag = min_mag;
+    for(int i = 0; i < first; i++)
+        curr_mag *= mult_frame;
+
+    c_frame = first;
+    capture_frame = first;
+    capture_dispatched = false;
+    dispatch_todo = false;
+    keyframe_index = -1;
+    keyframes_rendered = 0;
+
+    // The statistics of the view on screen would adapt the limit of the first frame
+    job.adapted = true;
+
+    openCaptureStream(first);
+    openJournal(first > 0);
+
+    if(cpu_capture)
+        startCpuCapture(first);
+}
+
+// Once the capture ran out of frames or got stopped, what was submitted gets written out first
+static void endCapture()
+{
+    stopCpuCapture();
+    finishReadback();
+    closeCaptureStream();
+    closeJournal();
+    single_mode = false;
+    d_prec = false;
+    c_frame = 0;
+    capture_dispatched = false;
+    dispatch_todo = false;
+}
+
+// Whether a frame file of the capture is whole, its header matches the frame size and the data runs to the
+// end the format says it has
+static bool frameFileComplete(const std::filesystem::path& path, int format)
+{
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    std::ifstream f(path, std::ios::binary);
+    if(ec || !f)
+        return false;
+
+    std::vector<unsigned char> head((size_t)std::min<uint64_t>(size, 65536));
+    if(!f.read((char*)head.data(), head.size()))
+        return false;
+
+    auto at = [&](uint64_t pos, unsigned char* dst, size_t n) {
+        f.clear();
+        return pos + n <= size && f.seekg(pos) && f.read((char*)dst, n);
+    };
+    auto le32 = [](const unsigned char* p) { return (uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; };
+    auto be32 = [](const unsigned char* p) { return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | (uint32_t)p[3]; };
+    unsigned char tail[12];
+
+    if(format == 0)
+    {
+        char header[64];
+        int n = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", T_SIZE_W, T_SIZE_H);
+        return size == (uint64_t)n + (uint64_t)T_SIZE_W * T_SIZE_H * 3 && memcmp(head.data(), header, n) == 0;
+    }
+    else if(format == 1)
+    {
+        static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        static const unsigned char iend[] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+        return size >= 24 + 12 && memcmp(head.data(), signature, 8) == 0 && be32(&head[16]) == T_SIZE_W &&
+            be32(&head[20]) == T_SIZE_H && at(size - 12, tail, 12) && memcmp(tail, iend, 12) == 0;
+    }
+    else if(format == 2)
+    {
+        static const unsigned char end[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+        return size >= 14 + 8 && memcmp(head.data(), "qoif", 4) == 0 && be32(&head[4]) == T_SIZE_W &&
+            be32(&head[8]) == T_SIZE_H && at(size - 8, tail, 8) && memcmp(tail, end, 8) == 0;
+    }
+
+    // EXR, the attributes up to the empty name, then the offset table. The last block ends the file
+    if(size < 8 || le32(&head[0]) != 20000630)
+        return false;
+
+    size_t pos = 8;
+    while(pos < head.size() && head[pos] != 0)
+    {
+        for(int z = 0; z < 2; z++)
+            while(pos < head.size() && head[pos++] != 0);
+        if(pos + 4 > head.size())
+            return false;
+        pos += 4 + le32(&head[pos]);
+    }
+
+    size_t blocks = (T_SIZE_H + 15) / 16;
+    pos += 1 + (blocks - 1) * 8;
+    if(pos + 8 > head.size())
+        return false;
+
+    uint64_t last = le32(&head[pos]) | (uint64_t)le32(&head[pos + 4]) << 32;
+    return at(last, tail, 8) && last + 8 + le32(&tail[4]) == size;
+}
+
+// Picks the unfinished capture that wrote to its journal last back up at its first frame missing on disk
+static bool resumeCapture()
+{
+    int epoch = -1;
+    std::filesystem::file_time_type latest;
+    for(const auto& e : std::filesystem::directory_iterator(std::filesystem::current_path()))
+    {
+        if(e.path().extension() != ".journal")
+            continue;
+
+        std::ifstream f(e.path());
+        std::string line, last;
+        while(std::getline(f, line))
+            if(!line.empty())
+                last = line;
+
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(e.path(), ec);
+        if(last != "done" && !ec && (epoch < 0 || time > latest))
+        {
+            epoch = atoi(e.path().stem().string().c_str());
+            latest = time;
+        }
+    }
+
+    if(epoch < 0)
+    {
+        std::cout << "No capture to resume" << std::endl;
+        return false;
+    }
+
+    std::ifstream f(journalPath(epoch));
+    std::string line;
+    std::vector<unsigned> limits; // Of every journaled frame, 0 for the others
+
+    while(std::getline(f, line))
+    {
+        std::istringstream in(line);
+        std::string key;
+        std::vector<double> v;
+        in >> key;
+        for(std::string tok; in >> tok;)
+            v.push_back(strtod(tok.c_str(), nullptr));
+
+        if(key == "view" && v.size() == 6)
+        {
+            lx = v[0];
+            ly = v[1];
+            iterations = (unsigned)v[2];
+            set = (unsigned)v[3];
+            smooth_it = v[4] != 0;
+            dist_est = v[5] != 0;
+        }
+        else if(key == "zoom" && v.size() == 3)
+        {
+            min_mag = v[0];
+            max_mag = v[1];
+            mult_frame = (float)v[2];
+        }
+        else if(key == "color" && v.size() == 6)
+        {
+            color_mode = (int)v[0];
+            color_scale = (int)v[1];
+            color_period = (float)v[2];
+            for(int c = 0; c < 3; c++)
+                single_color[c] = (float)v[3 + c];
+        }
+        else if(key == "stops" && !v.empty() && v.size() == 1 + 4 * (size_t)v[0])
+        {
+            custom_stops.clear();
+            for(size_t i = 1; i < v.size(); i += 4)
+                custom_stops.push_back({ (float)v[i], { (float)v[i + 1], (float)v[i + 2], (float)v[i + 3] } });
+        }
+        else if(key == "output" && v.size() == 4)
+        {
+            capture_format = (int)v[0];
+            image_format = (int)v[1];
+            exr_half = v[2] != 0;
+            capture_fps = (int)v[3];
+        }
+        else if(key == "mode" && v.size() == 3)
+        {
+            keyframe_zoom = v[0] != 0;
+            cpu_capture = v[1] != 0;
+            cpu_in_flight = (int)v[2];
+        }
+        else if(key == "aa" && v.size() == 2)
+        {
+            supersample = v[0] != 0;
+            aa_threshold = (float)v[1];
+        }
+        else if(key == "adaptive" && v.size() == 1)
+        {
+            adaptive_it = v[0] != 0;
+        }
+        else if(key == "frame" && v.size() == 2 && v[1] >= 1)
+        {
+            size_t i = (size_t)v[0];
+            if(limits.size() <= i)
+                limits.resize(i + 1);
+            limits[i] = (unsigned)v[1];
+        }
+    }
+
+    epoch_min = epoch;
+    palette_dirty = true;
+
+    // Frame files only exist once complete, the Y4M stream has to agree with the journal
+    int first = 0;
+    if(capture_format == 0)
+    {
+        auto dirname = std::filesystem::current_path() / std::to_string(epoch);
+        while(frameFileComplete(dirname / ("frame" + std::to_string(first) + image_extensions[image_format]), image_format))
+            first++;
+    }
+    else
+    {
+        while(first < (int)limits.size() && limits[first] != 0)
+            first++;
+
+        std::error_code ec;
+        auto size = std::filesystem::file_size(std::filesystem::current_path() / (std::to_string(epoch) + ".y4m"), ec);
+        size_t header = y4mHeader().size();
+        first = ec || size < header ? 0 : std::min(first, (int)((size - header) / y4mFrameBytes()));
+
+        // Same stream header, and every frame kept starts where its marker should be
+        std::ifstream y4m(std::filesystem::current_path() / (std::to_string(epoch) + ".y4m"), std::ios::binary);
+        std::string got(header, '\0');
+        if(!y4m.read(&got[0], header) || got != y4mHeader())
+            first = 0;
+
+        for(int i = 0; i < first; i++)
+        {
+            char marker[6];
+            y4m.seekg(header + (uint64_t)i * y4mFrameBytes());
+            if(!y4m.read(marker, 6) || memcmp(marker, "FRAME\n", 6) != 0)
+                first = i;
+        }
+    }
+
+    // Adaptive iterations take the limit of a frame from the statistics of the one before. The last
+    // journaled frame is done again at its own limit, the frames after it then get theirs the same way
+    if(adaptive_it && first > 0)
+    {
+        int back = first - 1;
+        while(back >= 0 && (back >= (int)limits.size() || limits[back] == 0))
+            back--;
+
+        first = std::max(back, 0);
+        if(back >= 0)
+            iterations = limits[back];
+    }
+
+    std::cout << "Resuming capture " << epoch << " at frame " << first << std::endl;
+    startCapture(first);
+    return true;
+}
+
+void scroll_callback(GLFWwindow* w, double sx, double sy)
+{
+    input_time = std::chrono::steady_clock::now();
+
+    if(pow2_zoom)
+    {
+        // Exact halving/doubling keeps the sample grids aligned, so a quarter of the pixels are reused
+        if(sy > 0.0)
+            g_scroll *= 0.5;
+        else if(sy < 0.0)
+            g_scroll *= 2.0;
+    }
+    else
+    {
+        g_scroll *= exp(-(sy * 0.1f));
+    }
+}
+
+void ui_window(InitData& idata)
+{
+    static const char* sets_name[] = {"Mandelbrot", "Burning Ship", "Mandelbrot-3"};
+    static const char* color_modes[] = {"Full Hue", "Single Color", "Custom Palette"};
+    static const char* color_scales[] = {"Relative to iterations", "Cyclic", "Histogram equalized", "Distance estimate"};
+    static int set_loc = 0;
+    static double llx = 0.0, lly = 0.0, llr = 1.0, llm = 0.0;
+    static int lls = 10;
+    static bool record_win = false;
+    static bool poli_win = false;
+    static bool palette_win = false;
+
+    ImGui::SetNextWindowPos(ImVec2(10, 10));
+    ImGui::SetNextWindowSize(ImVec2(300, 895));
+    ImGui::Begin("Settings", NULL,  ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoMove);
+
+    ImGui::Text("Alt-F4 to Exit");
+
+    ImGui::Separator();
+
+    ImGui::Text("Iterations [%u]", iterations);
+
+    ImGui::SameLine();
+    if (ImGui::Button("+10"))
+    {
+        iterations += 10;
+        if(iterations > 1000000) iterations = 1000000;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("-10"))
+    {
+        iterations -= 10;
+        if(iterations < 1) iterations = 1;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("+1"))
+    {
+        iterations += 1;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("-1"))
+    {
+        iterations -= 1;
+        if(iterations < 1) iterations = 1;
+    }
+
+    ImGui::Text("Mag Level [x%.2e]", 1.0 / g_scroll);
+    ImGui::Text("R = %.2e", g_scroll);
+
+    ImGui::Text("Center Coords [%.5e, %.5e]", lx / T_SIZE_W, ly / T_SIZE_H);
+
+    ImGui::Checkbox("Use double precision", &d_prec);
+    ImGui::Checkbox("Power of two zoom steps", &pow2_zoom);
+    ImGui::Checkbox("Smooth iteration count", &smooth_it);
+    ImGui::Checkbox("Distance estimation", &dist_est);
+    ImGui::Checkbox("Adaptive iterations", &adaptive_it);
+    aa_dirty |= ImGui::Checkbox("Adaptive supersampling", &supersample);
+
+    if(supersample)
+    {
+        aa_dirty |= ImGui::SliderFloat("AA threshold", &aa_threshold, 0.01f, 1.0f, "%.2f");
+    }
+
+    accum_dirty |= ImGui::Checkbox("Accumulate when idle", &temporal_aa) || aa_dirty;
+
+    if(temporal_aa)
+    {
+        ImGui::Text("Accumulated %u/%u samples", accum_frames, ACCUM_FRAMES);
+    }
+
+    if(adaptive_it)
     {
-        iterations -= 10;
-        if(iterations < 1) iterations = 1;
+        double px = (double)last_stats.escaped + last_stats.interior;
+        ImGui::Text("Interior %.1f%%, near limit %.2f%%, max escape %u", px > 0 ? 100.0 * last_stats.interior / px : 0.0,
+            px > 0 ? 100.0 * last_stats.near_max / px : 0.0, last_stats.max_escape);
     }
 
-    ImGui::SameLine();
-    if (ImGui::Button("+1"))
+    if(ImGui::Button("Benchmark kernel"))
     {
-        iterations += 1;
+        benchmark_todo = true;
     }
 
-    ImGui::SameLine();
-    if (ImGui::Button("-1"))
+    if(bench_int_ms > 0.0)
     {
-        iterations -= 1;
-        if(iterations < 1) iterations = 1;
+        ImGui::Text("Integer %.2f ms, smooth %.2f ms (%+.1f%%)", bench_int_ms, bench_smooth_ms, 100.0 * (bench_smooth_ms / bench_int_ms - 1.0));
+        ImGui::Text("Smooth with distance %.2f ms (%+.1f%%)", bench_de_ms, 100.0 * (bench_de_ms / bench_smooth_ms - 1.0));
     }
 
-    ImGui::Text("Mag Level [x%.2e]", 1.0 / g_scroll);
-    ImGui::Text("R = %.2e", g_scroll);
+    ImGui::Text("Average %.3f ms/frame", 1000.0f / ImGui::GetIO().Framerate);
+    ImGui::Text("Dispatched %llu px (%.2f%%)", last_dispatch_px, 100.0 * last_dispatch_px / ((double)T_SIZE_W * T_SIZE_H));
+    ImGui::Text("Reused on last zoom %llu px", last_reused_px);
 
-    ImGui::Text("Center Coords [%.5e, %.5e]", lx / T_SIZE_W, ly / T_SIZE_H);
+    if(job.done)
+        ImGui::Text("View done in %.1f ms", job.time_ms);
+    else
+        ImGui::Text("Refining pass %zu/%zu, tile %zu/%zu", job.pass + 1, job.strides.size(), job.next + 1, job.tiles.size());
 
-    ImGui::Checkbox("Use double precision", &d_prec);
+    if(job.cursor_ms >= 0.0)
+        ImGui::Text("Under cursor final in %.1f ms", job.cursor_ms);
+    else
+        ImGui::Text("Under cursor final in -");
 
-    ImGui::Text("Average %.3f ms/frame", 1000.0f / ImGui::GetIO().Framerate);
+    ImGui::Text("Aborted %u, last %.2f ms, worst %.2f ms", aborted_jobs, last_abort_ms, worst_abort_ms);
 
     ImGui::Separator();
     ImGui::Text("Coordinate input");
@@ -417,6 +4040,17 @@ void ui_window(InitData& idata)
 
     ImGui::Checkbox("Single Dispatch Mode", &single_mode);
 
+    static const char* progressive_modes[] = {"Full only", "1/4, Full", "1/16, 1/4, Full"};
+    static const char* pass_orders[] = {"Scanline", "Spiral from cursor", "Nearest to cursor", "Nearest to center"};
+    static int order_loc = (int)pass_order;
+
+    ImGui::Combo("Passes", &progressive_mode, progressive_modes, IM_ARRAYSIZE(progressive_modes));
+    if(ImGui::Combo("Pass order", &order_loc, pass_orders, IM_ARRAYSIZE(pass_orders)))
+    {
+        pass_order = (PassOrder)order_loc;
+    }
+    ImGui::SliderFloat("Frame budget", &frame_budget_ms, 1.0f, 100.0f, "%.0f ms");
+
     if(single_mode)
     {
         if(ImGui::Button("Run!"))
@@ -434,11 +4068,30 @@ void ui_window(InitData& idata)
 
     ImGui::Separator();
 
-    ImGui::Combo("Color Mode", &color_mode, color_modes, IM_ARRAYSIZE(color_modes));
+    palette_dirty |= ImGui::Combo("Color Mode", &color_mode, color_modes, IM_ARRAYSIZE(color_modes));
+
+    // Cyclic colors don't depend on iterations, so captures that grow it don't shift the palette
+    accum_dirty |= ImGui::Combo("Color Scale", &color_scale, color_scales, IM_ARRAYSIZE(color_scales));
+
+    // Needs the estimates in the first place
+    if(color_scale == 3)
+        dist_est = true;
+
+    if(color_scale == 1)
+    {
+        accum_dirty |= ImGui::DragFloat("Period", &color_period, 1.0f, 1.0f, 100000.0f, "%.0f iterations");
+    }
 
     if(color_mode == 1)
     {
-        ImGui::ColorEdit3("Color", single_color);
+        palette_dirty |= ImGui::ColorEdit3("Color", single_color);
+    }
+    else if(color_mode == 2)
+    {
+        if(ImGui::Button(!palette_win ? "Open Palette Editor" : "Close Palette Editor"))
+        {
+            palette_win = !palette_win;
+        }
     }
 
     ImGui::Separator();
@@ -468,6 +4121,33 @@ void ui_window(InitData& idata)
         update_frame_info |= ImGui::InputDouble("Mag Stop", &max_mag);
         update_frame_info |= ImGui::InputFloat("Multiplier per frame", &mult_frame, 0.0f, 0.0f, "%.2f");
 
+        static const char* capture_formats[] = {"Image frames", "Y4M file", "Y4M to stdout"};
+        ImGui::Combo("Output", &capture_format, capture_formats, IM_ARRAYSIZE(capture_formats));
+
+        // Also used by stills
+        static const char* image_formats[] = {"PPM", "PNG", "QOI", "EXR"};
+        ImGui::Combo("Image format", &image_format, image_formats, IM_ARRAYSIZE(image_formats));
+
+        if(image_format == 3)
+            ImGui::Checkbox("Half float color", &exr_half);
+
+        ImGui::Checkbox("Keyframe zoom", &keyframe_zoom);
+        if(ImGui::IsItemHovered())
+            ImGui::SetTooltip("Iterate one keyframe per 2x of zoom, frames are resampled from it");
+
+        ImGui::Checkbox("Iterate on CPU", &cpu_capture);
+        if(cpu_capture)
+        {
+            ImGui::SliderInt("Frames in flight", &cpu_in_flight, 1, CPU_MAX_IN_FLIGHT);
+            keyframe_zoom = false;
+        }
+
+        if(capture_format != 0)
+        {
+            ImGui::InputInt("Stream fps", &capture_fps);
+            capture_fps = std::max(capture_fps, 1);
+        }
+
         if(update_frame_info)
         {
             number_frames = log(max_mag / min_mag) / log(mult_frame);
@@ -477,26 +4157,36 @@ void ui_window(InitData& idata)
 
         if(ImGui::Button(!run_capture ? "Start Capture" : "Stop Capture"))
         {
+            if(run_capture)
+            {
+                // The frame in flight is dropped, everything saved before it is kept
+                endCapture();
+                run_capture = false;
+            }
             // Calculate frames
-            if(min_mag > max_mag)
+            else if(min_mag > max_mag)
             {
                 std::cout << "error: Min mag > max mag" << std::endl;
             }
             else
             {
-                number_frames = log(max_mag / min_mag) / log(mult_frame);
-                std::cout << "Frames to generate: " << number_frames << std::endl;
-                std::cout << "Duration: " << number_frames / 30.0 << "s at 30 fps" << std::endl;
-                std::cout << "Duration: " << number_frames / 60.0 << "s at 60 fps" << std::endl;
-
                 run_capture = true;
-                single_mode = true;
-                d_prec = true;
-                curr_mag = min_mag;
-                iterations_real = iterations;
-                epoch_min = std::chrono::duration_cast<std::chrono::minutes>(
-                    std::chrono::steady_clock::now().time_since_epoch()
-                ).count();
+                epoch_min = newCaptureEpoch();
+                startCapture(0);
+            }
+        }
+
+        if(!run_capture)
+        {
+            ImGui::SameLine();
+            if(ImGui::Button("Resume"))
+                run_capture = resumeCapture();
+
+            ImGui::SameLine();
+            if(ImGui::Button("Save Still"))
+            {
+                auto stamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                saveFBOImage(idata, (std::filesystem::current_path() / ("still" + std::to_string(stamp) + image_extensions[image_format])).string());
             }
         }
 
@@ -505,20 +4195,39 @@ void ui_window(InitData& idata)
         ImGui::Text("Duration: %fs at 30 fps", number_frames / 30.0);
         ImGui::Text("Duration: %fs at 60 fps", number_frames / 60.0);
 
-        if(curr_mag <= max_mag && run_capture)
+        // Workers stay around until the capture ends, so toggling the checkbox meanwhile changes nothing
+        bool on_cpu = !cpu.threads.empty();
+
+        if(run_capture && on_cpu && cpu.next_out < cpu.views.size())
         {
-            long long ns = runSingleFrameTimed(curr_mag, idata);
+            runCpuFrames(idata);
+
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - cpu.start).count();
+            ImGui::Text("Throughput: %.2f frames/s", cpu.next_out / s);
+            ImGui::Text("Written Frame %u/%u", cpu.next_out, (unsigned)cpu.views.size());
+        }
+        else if(curr_mag <= max_mag && run_capture && !on_cpu)
+        {
+            long long ns = keyframe_zoom ? runKeyframeFrameTimed(curr_mag, idata) : runSingleFrameTimed(curr_mag, idata);
             ImGui::Text("Frame Time: %f ms", ns / 1E6f);
+            if(keyframe_zoom)
+                ImGui::Text("Keyframes: %u", keyframes_rendered);
+            else
+                ImGui::Text("Reused: %.2f%%", 100.0 * last_reused_px / ((double)T_SIZE_W * T_SIZE_H));
             ImGui::Text("Calculating Frame %u/%u", c_frame++, number_frames);
             curr_mag *= mult_frame;
         }
         else if(single_mode && run_capture)
         {
+            // The last dispatched frame still has to be saved
+            if(capture_dispatched)
+            {
+                saveFBOImage(idata);
+                capture_dispatched = false;
+            }
+
+            endCapture();
             run_capture = false;
-            single_mode = false;
-            d_prec = false;
-            c_frame = 0;
-            iterations_real = 0.0;
         }
 
         ImGui::End();
@@ -581,6 +4290,37 @@ void ui_window(InitData& idata)
 
         ImGui::End();
     }
+
+    if(palette_win && color_mode == 2)
+    {
+        ImGui::SetNextWindowPos(ImVec2(T_SIZE_W - 310, 470));
+        ImGui::SetNextWindowSize(ImVec2(300, 450));
+        ImGui::Begin("Palette Editor", &palette_win, ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoMove);
+
+        // Only the lookup texture gets re-uploaded, the fractal is not recomputed
+        if(ImGui::Button("Add Stop"))
+        {
+            float pos = custom_stops.empty() ? 0.0f : std::min(custom_stops.back().pos + 0.1f, 1.0f);
+            custom_stops.push_back({ pos, { 1.0f, 1.0f, 1.0f } });
+            palette_dirty = true;
+        }
+
+        ImGui::SameLine();
+        if(ImGui::Button("Remove Stop") && custom_stops.size() > 1)
+        {
+            custom_stops.pop_back();
+            palette_dirty = true;
+        }
+
+        for(size_t j = 0; j < custom_stops.size(); j++)
+        {
+            ImGui::Separator();
+            palette_dirty |= ImGui::SliderFloat(("Position " + std::to_string(j)).c_str(), &custom_stops[j].pos, 0.0f, 1.0f, "%.3f");
+            palette_dirty |= ImGui::ColorEdit3(("Color " + std::to_string(j)).c_str(), custom_stops[j].color);
+        }
+
+        ImGui::End();
+    }
 }
 
 void GLAPIENTRY
@@ -598,9 +4338,586 @@ MessageCallback( GLenum source,
             type, severity, message );
 }
 
-int main()
+// Surfaceless EGL context, batch renders then need no display at all (SSH sessions, containers). libEGL is
+// loaded at runtime so nothing new gets linked, without it or off Linux the batch falls back to a hidden
+// GLFW window. With Mesa, LIBGL_ALWAYS_SOFTWARE=1 renders on llvmpipe
+struct OffscreenContext
+{
+    // The few EGL entry points and enums needed, as in egl.h and eglext.h
+    typedef void* (*GetProcAddress)(const char* name);
+    typedef const char* (*QueryString)(void* display, int name);
+    typedef void* (*GetPlatformDisplay)(unsigned platform, void* native, const int* attribs);
+    typedef unsigned (*Initialize)(void* display, int* major, int* minor);
+    typedef unsigned (*ChooseConfig)(void* display, const int* attribs, void** configs, int size, int* count);
+    typedef unsigned (*BindAPI)(unsigned api);
+    typedef void* (*CreateContext)(void* display, void* config, void* share, const int* attribs);
+    typedef unsigned (*MakeCurrent)(void* display, void* draw, void* read, void* context);
+    typedef unsigned (*DestroyContext)(void* display, void* context);
+    typedef unsigned (*Terminate)(void* display);
+
+    enum : int
+    {
+        NONE = 0x3038,
+        EXTENSIONS = 0x3055,
+        RENDERABLE_TYPE = 0x3040,
+        OPENGL_BIT = 0x0008,
+        OPENGL_API = 0x30A2,
+        CONTEXT_MAJOR_VERSION = 0x3098,
+        CONTEXT_MINOR_VERSION = 0x30FB,
+        CONTEXT_OPENGL_PROFILE_MASK = 0x30FD,
+        CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT = 0x0002,
+        PLATFORM_SURFACELESS_MESA = 0x31DD
+    };
+
+    void* lib = nullptr;
+    void* display = nullptr;
+    void* context = nullptr;
+    GetProcAddress getProcAddress = nullptr;
+    MakeCurrent makeCurrent = nullptr;
+    DestroyContext destroyContext = nullptr;
+    Terminate terminate = nullptr;
+};
+
+OffscreenContext offscreen;
+
+static void destroyOffscreenContext()
+{
+#ifdef __linux__
+    OffscreenContext& o = offscreen;
+
+    if(o.context)
+    {
+        o.makeCurrent(o.display, nullptr, nullptr, nullptr);
+        o.destroyContext(o.display, o.context);
+    }
+    if(o.display)
+        o.terminate(o.display);
+    if(o.lib)
+        dlclose(o.lib);
+
+    o = OffscreenContext();
+#endif
+}
+
+// Makes the context current and loads GL through it, false with the reason on stderr when there is none
+static bool createOffscreenContext()
+{
+#ifdef __linux__
+    OffscreenContext& o = offscreen;
+    auto fail = [](const char* why) {
+        std::cerr << "No surfaceless EGL context, " << why << std::endl;
+        destroyOffscreenContext();
+        return false;
+    };
+
+    o.lib = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if(!o.lib)
+        return fail("libEGL.so.1 not found");
+
+    o.getProcAddress = (OffscreenContext::GetProcAddress)dlsym(o.lib, "eglGetProcAddress");
+    o.makeCurrent = (OffscreenContext::MakeCurrent)dlsym(o.lib, "eglMakeCurrent");
+    o.destroyContext = (OffscreenContext::DestroyContext)dlsym(o.lib, "eglDestroyContext");
+    o.terminate = (OffscreenContext::Terminate)dlsym(o.lib, "eglTerminate");
+    auto queryString = (OffscreenContext::QueryString)dlsym(o.lib, "eglQueryString");
+    auto initialize = (OffscreenContext::Initialize)dlsym(o.lib, "eglInitialize");
+    auto chooseConfig = (OffscreenContext::ChooseConfig)dlsym(o.lib, "eglChooseConfig");
+    auto bindAPI = (OffscreenContext::BindAPI)dlsym(o.lib, "eglBindAPI");
+    auto createContext = (OffscreenContext::CreateContext)dlsym(o.lib, "eglCreateContext");
+    if(!o.getProcAddress || !o.makeCurrent || !o.destroyContext || !o.terminate || !queryString || !initialize ||
+        !chooseConfig || !bindAPI || !createContext)
+        return fail("libEGL.so.1 is missing entry points");
+
+    // Client extensions, queried without a display
+    const char* client = queryString(nullptr, OffscreenContext::EXTENSIONS);
+    auto getPlatformDisplay = (OffscreenContext::GetPlatformDisplay)o.getProcAddress("eglGetPlatformDisplayEXT");
+    if(!client || !strstr(client, "EGL_MESA_platform_surfaceless") || !getPlatformDisplay)
+        return fail("the surfaceless platform isn't supported");
+
+    int major, minor;
+    o.display = getPlatformDisplay(OffscreenContext::PLATFORM_SURFACELESS_MESA, nullptr, nullptr);
+    if(!o.display || !initialize(o.display, &major, &minor))
+    {
+        o.display = nullptr;
+        return fail("the display didn't initialize");
+    }
+
+    const char* ext = queryString(o.display, OffscreenContext::EXTENSIONS);
+    if(!ext || !strstr(ext, "EGL_KHR_surfaceless_context"))
+        return fail("contexts need a surface");
+
+    // Nothing is drawn to a surface, any config does when one is required
+    void* config = nullptr;
+    if(!strstr(ext, "EGL_KHR_no_config_context"))
+    {
+        const int attribs[] = {OffscreenContext::RENDERABLE_TYPE, OffscreenContext::OPENGL_BIT, OffscreenContext::NONE};
+        int count = 0;
+        if(!chooseConfig(o.display, attribs, &config, 1, &count) || count < 1)
+            return fail("no OpenGL config");
+    }
+
+    const int attribs[] = {
+        OffscreenContext::CONTEXT_MAJOR_VERSION, 4,
+        OffscreenContext::CONTEXT_MINOR_VERSION, 5,
+        OffscreenContext::CONTEXT_OPENGL_PROFILE_MASK, OffscreenContext::CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        OffscreenContext::NONE};
+    if(!bindAPI(OffscreenContext::OPENGL_API) || !(o.context = createContext(o.display, config, nullptr, attribs)))
+        return fail("no OpenGL 4.5 context");
+
+    if(!o.makeCurrent(o.display, nullptr, nullptr, o.context))
+        return fail("the context can't be made current");
+
+    if(!gladLoadGLLoader((GLADloadproc)o.getProcAddress))
+        return fail("GLAD failed to load");
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Headless batch rendering, FractalGenerator --batch jobs.txt [--summary summary.json]. The job file holds
+// one setting per line, a setting holds for every job after it and "render <path>" queues a job:
+//
+//   set ship                mandelbrot, ship or mandelbrot3
+//   precision double        float or double, the CPU backend always iterates in double
+//   iterations 2000
+//   smooth 1
+//   de 0                    distance estimation
+//   center -1.7497 0.0      real and imaginary part
+//   mag 1e6
+//   size 7680x4320          rendered in tiles when not the 1920x1080 of the buffers, ppm only
+//   backend cpu             gpu or cpu
+//   color 2 3 64            color mode, color scale and period, as numbered in the settings window
+//                           scale 3 colors by distance and turns de on for the job
+//   supersample 1
+//   half 1                  half float EXR color
+//   render out/ship.png     format by extension, ppm, png, qoi or exr
+//
+// Everything after a "#" is a comment. GPU jobs run one after the other while the CPU ones are iterated
+// by the worker threads of the CPU backend. A JSON summary with the time of every job goes to stdout.
+// Tiles are colored on their own, so the histogram color scale equalizes every tile separately
+#define BATCH_OK 0          // Every job written
+#define BATCH_JOB_FAILED 1  // Some job wasn't, the others were
+#define BATCH_BAD_INPUT 2   // Bad arguments or job file, nothing rendered
+#define BATCH_NO_CONTEXT 3  // No OpenGL context
+
+struct BatchJob
+{
+    CpuView view;
+    bool d_prec;
+    bool cpu;
+    int width, height;
+    int color_mode, color_scale;
+    float color_period;
+    bool exr_half;
+    int line = 0;
+    std::string error = "";
+};
+
+std::vector<BatchJob> batch_jobs;
+std::vector<unsigned> batch_cpu_jobs; // Job of every CPU backend view
+
+static bool parseBatchFile(const char* path, std::string& error)
+{
+    std::ifstream in(path);
+    if(!in)
+    {
+        error = std::string("Could not open ") + path;
+        return false;
+    }
+
+    // Starts from the defaults of the settings window
+    BatchJob cur{{lx, ly, 1.0 / g_scroll, iterations, set, smooth_it, dist_est, supersample}, d_prec, false,
+        T_SIZE_W, T_SIZE_H, color_mode, color_scale, color_period, exr_half};
+    std::string line;
+
+    for(int n = 1; std::getline(in, line); n++)
+    {
+        std::istringstream ls(line.substr(0, line.find('#')));
+        std::string key, word;
+        int flag = 0;
+        if(!(ls >> key))
+            continue;
+
+        bool ok = true;
+        if(key == "set")
+        {
+            static const char* names[] = {"mandelbrot", "ship", "mandelbrot3"};
+            ls >> word;
+            ok = false;
+            for(unsigned i = 0; i < 3; i++)
+                if(word == names[i])
+                {
+                    cur.view.set = i;
+                    ok = true;
+                }
+        }
+        else if(key == "precision")
+        {
+            ls >> word;
+            ok = word == "float" || word == "double";
+            cur.d_prec = word == "double";
+        }
+        else if(key == "iterations")
+        {
+            ls >> cur.view.iterations;
+            ok = cur.view.iterations >= 1 && cur.view.iterations <= 1000000;
+        }
+        else if(key == "smooth" || key == "de" || key == "supersample" || key == "half")
+        {
+            ls >> flag;
+            ok = flag == 0 || flag == 1;
+            (key == "smooth" ? cur.view.smooth_it : key == "de" ? cur.view.dist_est :
+                key == "supersample" ? cur.view.supersample : cur.exr_half) = flag;
+        }
+        else if(key == "center")
+        {
+            double re, im;
+            ls >> re >> im;
+            cur.view.lx = -re * T_SIZE_W;
+            cur.view.ly = im * T_SIZE_H;
+        }
+        else if(key == "mag")
+        {
+            ls >> cur.view.mag;
+            ok = cur.view.mag > 0.0;
+        }
+        else if(key == "size")
+        {
+            char x = 0;
+            ls >> cur.width >> x >> cur.height;
+            ok = x == 'x' && cur.width > 0 && cur.height > 0 && cur.width <= 65536 && cur.height <= 65536;
+        }
+        else if(key == "backend")
+        {
+            ls >> word;
+            ok = word == "gpu" || word == "cpu";
+            cur.cpu = word == "cpu";
+        }
+        else if(key == "color")
+        {
+            ls >> cur.color_mode >> cur.color_scale >> cur.color_period;
+            ok = cur.color_mode >= 0 && cur.color_mode <= 2 && cur.color_scale >= 0 && cur.color_scale <= 3 &&
+                cur.color_period > 0.0f;
+        }
+        else if(key == "render")
+        {
+            std::getline(ls >> std::ws, cur.view.path);
+            cur.view.path.erase(cur.view.path.find_last_not_of(" \t\r") + 1);
+            ok = !cur.view.path.empty();
+            cur.line = n;
+            batch_jobs.push_back(cur);
+
+            // Needs the estimates in the first place, as in the settings window
+            if(cur.color_scale == 3)
+                batch_jobs.back().view.dist_est = true;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if(!ok || ls.fail() || ls >> word)
+        {
+            error = std::string(path) + ":" + std::to_string(n) + ": bad line \"" + line + "\"";
+            return false;
+        }
+    }
+
+    if(batch_jobs.empty())
+    {
+        error = std::string(path) + ": nothing to render";
+        return false;
+    }
+    return true;
+}
+
+// Everything the coloring and the writer read from the globals
+static void applyBatchColor(const BatchJob& j)
+{
+    if(color_mode != j.color_mode)
+        palette_dirty = true;
+    color_mode = j.color_mode;
+    color_scale = j.color_scale;
+    color_period = j.color_period;
+    exr_half = j.exr_half;
+    image_format = imageFormatOf(j.view.path);
+}
+
+static void applyBatchFrame(unsigned index)
+{
+    applyBatchColor(batch_jobs[batch_cpu_jobs[index]]);
+}
+
+static std::string jsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for(unsigned char c : s)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if(c < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// View of one tile of a poster job. The magnification frames the whole poster height, the tiles keep its
+// pixel size and are centered on their part of it
+static CpuView posterTileView(const BatchJob& j, Poster& p, int tile)
+{
+    const double pixel = 2.0 / (j.view.mag * j.height);
+    const double cx = -j.view.lx / T_SIZE_W + (tile % p.columns * T_SIZE_W + T_SIZE_W / 2 - j.width / 2.0) * pixel;
+    const double cy = j.view.ly / T_SIZE_H + (tile / p.columns * T_SIZE_H + T_SIZE_H / 2 - j.height / 2.0) * pixel;
+
+    CpuView v = j.view;
+    v.lx = -cx * T_SIZE_W;
+    v.ly = cy * T_SIZE_H;
+    v.mag = j.view.mag * j.height / T_SIZE_H;
+    v.poster = &p;
+    v.tile = tile;
+    return v;
+}
+
+// Iterates the view of a GPU job on the compute program, returns how long it took
+static double renderBatchView(InitData& idata, const BatchJob& j, const CpuView& v)
+{
+    using namespace std::chrono;
+
+    lx = v.lx;
+    ly = v.ly;
+    g_scroll = 1.0 / v.mag;
+    iterations = v.iterations;
+    set = v.set;
+    smooth_it = v.smooth_it;
+    dist_est = v.dist_est;
+    d_prec = j.d_prec;
+    supersample = v.supersample;
+    applyBatchColor(j);
+
+    glUseProgram(idata.compute_program);
+    glUniform1i(idata.d_precl, (int)d_prec);
+    setViewUniforms(idata);
+
+    // Nothing carried over from the view before, the CPU frames went through the same textures
+    last_view_valid = false;
+    aa_dirty = true;
+
+    auto t = steady_clock::now();
+    glBindFramebuffer(GL_FRAMEBUFFER, idata.fb);
+    dispatchView(idata, true, T_SIZE_W / 2, T_SIZE_H / 2);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glFinish();
+    return duration<double, std::milli>(steady_clock::now() - t).count();
+}
+
+// context names what the jobs ran on, together with the GL renderer
+static int runBatch(InitData& idata, const char* summary_path, const char* context)
+{
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    std::vector<double> ms(batch_jobs.size(), 0.0);
+    std::vector<int> tiles(batch_jobs.size(), 1);
+
+    // Jobs at another size than the buffers are posters, rendered in tiles
+    std::deque<Poster> posters;
+    std::vector<Poster*> poster(batch_jobs.size(), nullptr);
+
+    // Jobs that can't be rendered fail on their own, the rest of the batch goes on
+    std::vector<CpuView> cpu_views;
+    for(unsigned i = 0; i < batch_jobs.size(); i++)
+    {
+        BatchJob& j = batch_jobs[i];
+        bool tiled = j.width != T_SIZE_W || j.height != T_SIZE_H;
+        if(imageFormatOf(j.view.path) < 0)
+            j.error = "unknown image format";
+        else if(tiled && imageFormatOf(j.view.path) != 0)
+            j.error = "sizes other than " + std::to_string(T_SIZE_W) + "x" + std::to_string(T_SIZE_H) +
+                " are rendered in tiles, only to ppm";
+
+        // An output left over from an earlier run would pass for this one
+        std::error_code ec;
+        if(j.error.empty() && std::filesystem::exists(j.view.path, ec) && !std::filesystem::remove(j.view.path, ec))
+            j.error = "could not replace the output";
+
+        if(j.error.empty() && tiled)
+        {
+            Poster& p = posters.emplace_back();
+            p.path = j.view.path;
+            p.width = j.width;
+            p.height = j.height;
+            if(openPoster(&p))
+            {
+                poster[i] = &p;
+                tiles[i] = p.columns * p.rows;
+            }
+            else
+            {
+                j.error = "could not open the output";
+            }
+        }
+
+        if(j.error.empty() && j.cpu)
+            for(int t = 0; t < tiles[i]; t++)
+            {
+                batch_cpu_jobs.push_back(i);
+                cpu_views.push_back(poster[i] ? posterTileView(j, *poster[i], t) : j.view);
+            }
+    }
+
+    if(!cpu_views.empty())
+        startCpuRender(std::move(cpu_views), 0, cpu_in_flight);
+
+    for(unsigned i = 0; i < batch_jobs.size(); i++)
+    {
+        BatchJob& j = batch_jobs[i];
+        if(!j.error.empty() || j.cpu)
+            continue;
+
+        for(int t = 0; t < tiles[i]; t++)
+        {
+            CpuView v = poster[i] ? posterTileView(j, *poster[i], t) : j.view;
+            ms[i] += renderBatchView(idata, j, v);
+            saveFBOImage(idata, v.path, v.poster, v.tile);
+
+            // CPU frames done in the meantime
+            runCpuFrames(idata, applyBatchFrame);
+        }
+    }
+
+    while(!batch_cpu_jobs.empty() && cpu.next_out < cpu.views.size())
+        if(!runCpuFrames(idata, applyBatchFrame))
+            std::this_thread::sleep_for(milliseconds(2));
+
+    // Summed over the tiles of a poster
+    for(unsigned k = 0; k < batch_cpu_jobs.size(); k++)
+        ms[batch_cpu_jobs[k]] += cpu.views[k].ms;
+
+    finishReadback();
+
+    // Outputs are renamed into place once complete, an existing one was written
+    unsigned failed = 0;
+    std::ostringstream json;
+    json << "{\n  \"jobs\": [\n";
+    for(unsigned i = 0; i < batch_jobs.size(); i++)
+    {
+        BatchJob& j = batch_jobs[i];
+        std::error_code ec;
+        if(j.error.empty() && !std::filesystem::exists(j.view.path, ec))
+            j.error = "could not write the output";
+        failed += !j.error.empty();
+
+        json << "    {\"line\": " << j.line << ", \"output\": " << jsonString(j.view.path) << ", \"backend\": \""
+            << (j.cpu ? "cpu" : "gpu") << "\", \"status\": \"" << (j.error.empty() ? "ok" : "failed") << "\"";
+        if(!j.error.empty())
+            json << ", \"error\": " << jsonString(j.error);
+        json << ", \"tiles\": " << tiles[i] << ", \"ms\": " << ms[i] << "}" << (i + 1 < batch_jobs.size() ? "," : "") << "\n";
+    }
+    json << "  ],\n  \"context\": \"" << context << "\",\n  \"renderer\": "
+        << jsonString((const char*)glGetString(GL_RENDERER)) << ",\n  \"threads\": " << std::max(std::thread::hardware_concurrency(), 1u)
+        << ",\n  \"failed\": " << failed << ",\n  \"total_ms\": "
+        << duration<double, std::milli>(steady_clock::now() - start).count() << "\n}\n";
+
+    if(!summary_path)
+    {
+        fputs(json.str().c_str(), stdout);
+        fflush(stdout);
+    }
+    else if(!(std::ofstream(summary_path) << json.str()))
+    {
+        std::cerr << "Could not write the summary to " << summary_path << std::endl;
+        return BATCH_JOB_FAILED;
+    }
+
+    return failed ? BATCH_JOB_FAILED : BATCH_OK;
+}
+
+// Renders the job file with no window to be seen, on a surfaceless context if there is one
+static int batchMain(const char* job_path, const char* summary_path)
+{
+    std::string error;
+    if(!parseBatchFile(job_path, error))
+    {
+        std::cerr << error << std::endl;
+        return BATCH_BAD_INPUT;
+    }
+
+    // Shader logs and the like go to stderr, stdout only gets the summary
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    bool surfaceless = createOffscreenContext();
+    if(!surfaceless)
+    {
+        if(!glfwInit())
+        {
+            std::cerr << "Could not initialize GLFW" << std::endl;
+            return BATCH_NO_CONTEXT;
+        }
+
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow* window = glfwCreateWindow(T_SIZE_W, T_SIZE_H, "FractalGenerator", NULL, NULL);
+        if(!window)
+        {
+            std::cerr << "Could not create an OpenGL context" << std::endl;
+            glfwTerminate();
+            return BATCH_NO_CONTEXT;
+        }
+
+        glfwMakeContextCurrent(window);
+        if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cerr << "Failed to initialize GLAD" << std::endl;
+            glfwTerminate();
+            return BATCH_NO_CONTEXT;
+        }
+    }
+
+    InitData idata = Initialize(T_SIZE_W, T_SIZE_H);
+    int code = runBatch(idata, summary_path, surfaceless ? "egl" : "glfw");
+
+    stopCpuCapture();
+    shutdownReadback();
+    CleanUp(idata);
+
+    if(surfaceless)
+        destroyOffscreenContext();
+    else
+        glfwTerminate();
+    return code;
+}
+
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
+    const char* batch_path = nullptr;
+    const char* summary_path = nullptr;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_path = argv[++i];
+        else if(!strcmp(argv[i], "--summary") && i + 1 < argc)
+            summary_path = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--batch <job file> [--summary <json file>]]" << std::endl;
+            return BATCH_BAD_INPUT;
+        }
+    }
+
+    if(batch_path)
+        return batchMain(batch_path, summary_path);
 
     /* Initialize the library */
     if (!glfwInit())
@@ -641,8 +4958,7 @@ int main()
     InitData idata = Initialize(T_SIZE_W, T_SIZE_H);
 
     double x, y;
-    double rx = 0.0, ry = 0.0;
-    bool pressed = false;
+    main_window = window;
 
     glfwWindowHint(GLFW_SAMPLES, 4);
     glEnable(GL_MULTISAMPLE);
@@ -655,7 +4971,7 @@ int main()
     while (!glfwWindowShouldClose(window))
     {
         /* Poll for and process events */
-        glfwPollEvents();
+        pollInput();
 
         /* Compute stage 0 */
         glUseProgram(idata.compute_program);
@@ -667,30 +4983,6 @@ int main()
 
         if(!single_mode)
         {
-            if(glfwGetMouseButton(window, 0) == GLFW_PRESS)
-            {
-                if(!pressed)
-                {
-                    rx = x;
-                    ry = y;
-                    pressed = true;
-                }
-                else
-                {
-                    lx += (x - rx) * g_scroll;
-                    ly += (y - ry) * g_scroll;
-
-                    rx = x;
-                    ry = y;
-                }
-            }
-            else if(glfwGetMouseButton(window, 0) == GLFW_RELEASE && pressed)
-            {
-                pressed = false;
-            }
-
-            
-
             if(glfwGetKey(window, GLFW_KEY_KP_ADD) == GLFW_PRESS)
             {
                 iterations += 1;
@@ -705,40 +4997,53 @@ int main()
             }
         }
 
-        glUniform1d(idata.pxld, lx / T_SIZE_W);
-        glUniform1d(idata.pyld, ly / T_SIZE_H);
-        glUniform1f(idata.pxl, (float)lx / T_SIZE_W);
-        glUniform1f(idata.pyl, (float)ly / T_SIZE_H);
-        glUniform1d(idata.zoomld, g_scroll);
-        glUniform1f(idata.zooml, (float)g_scroll);
-        glUniform1ui(idata.max_itl, iterations);
-        glUniform1ui(idata.setl, set);
-        glUniform1i(idata.cmodel, color_mode);
-        glUniform3fv(idata.color_gradl, 1, single_color);
+        setViewUniforms(idata);
 
         if(!single_mode)
         {
             glBindFramebuffer(GL_FRAMEBUFFER, idata.fb);
-            glDispatchCompute(T_SIZE_W, T_SIZE_H, 1);
+            dispatchView(idata, false, x, y);
         }
         else if(dispatch_todo)
         {
             dispatchDone = false;
             glBindFramebuffer(GL_FRAMEBUFFER, idata.fb);
-            glDispatchCompute(T_SIZE_W, T_SIZE_H, 1);
+            dispatchView(idata, true, x, y);
             dispatch_todo = false;
         }
 
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        // The next frame picks the new limit up, reusing every escaped pixel
+        if(adaptive_it && job.done && !job.adapted)
+        {
+            adaptIterations(idata);
+            job.adapted = true;
+        }
+
+        if(benchmark_todo)
+        {
+            benchmarkKernel(idata);
+            benchmark_todo = false;
+        }
+
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
         dispatchDone = true;
 
+        // Captured frames that landed in the meantime go to the writer
+        pollReadback(false);
+
+        if(!single_mode)
+        {
+            runAccumulation(idata, frame_budget_ms);
+        }
+
         /* Render here */
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(idata.render_program);
+        setColorUniforms(idata);
+        glUniform1i(idata.frag_model, accum_frames > 1 && !single_mode ? 2 : 0);
         glBindVertexArray(idata.rect_vao);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, idata.texture);
+        glBindTexture(GL_TEXTURE_2D, idata.iter_texture);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
         ImGui_ImplOpenGL3_NewFrame();
@@ -754,6 +5059,8 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    stopCpuCapture();
+    shutdownReadback();
     CleanUp(idata);
 
     glfwTerminate();